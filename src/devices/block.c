@@ -16,8 +16,10 @@ struct block {
   const struct block_operations* ops; /* Driver operations. */
   void* aux;                          /* Extra data owned by driver. */
 
-  unsigned long long read_cnt;  /* Number of sectors read. */
-  unsigned long long write_cnt; /* Number of sectors written. */
+  unsigned long long read_cnt;      /* Number of sectors read. */
+  unsigned long long write_cnt;     /* Number of sectors written. */
+  unsigned long long read_cmd_cnt;  /* Number of read commands issued. */
+  unsigned long long write_cmd_cnt; /* Number of write commands issued. */
 };
 
 /* List of all block devices. */
@@ -98,6 +100,7 @@ void block_read(struct block* block, block_sector_t sector, void* buffer) {
   check_sector(block, sector);
   block->ops->read(block->aux, sector, buffer);
   block->read_cnt++;
+  block->read_cmd_cnt++;
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -110,6 +113,55 @@ void block_write(struct block* block, block_sector_t sector, const void* buffer)
   ASSERT(block->type != BLOCK_FOREIGN);
   block->ops->write(block->aux, sector, buffer);
   block->write_cnt++;
+  block->write_cmd_cnt++;
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses a single device command where the driver
+   supports it.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void block_read_multiple(struct block* block, block_sector_t sector, block_sector_t cnt,
+                         void* buffer) {
+  ASSERT(cnt > 0);
+  check_sector(block, sector);
+  check_sector(block, sector + cnt - 1);
+  if (block->ops->read_multiple != NULL) {
+    block->ops->read_multiple(block->aux, sector, cnt, buffer);
+    block->read_cmd_cnt++;
+  } else {
+    block_sector_t i;
+    for (i = 0; i < cnt; i++)
+      block->ops->read(block->aux, sector + i, (char*)buffer + i * BLOCK_SECTOR_SIZE);
+    block->read_cmd_cnt += cnt;
+  }
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Uses a single device command where the driver supports it.
+   Returns after the block device has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void block_write_multiple(struct block* block, block_sector_t sector, block_sector_t cnt,
+                          const void* buffer) {
+  ASSERT(cnt > 0);
+  check_sector(block, sector);
+  check_sector(block, sector + cnt - 1);
+  ASSERT(block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL) {
+    block->ops->write_multiple(block->aux, sector, cnt, buffer);
+    block->write_cmd_cnt++;
+  } else {
+    block_sector_t i;
+    for (i = 0; i < cnt; i++)
+      block->ops->write(block->aux, sector + i, (const char*)buffer + i * BLOCK_SECTOR_SIZE);
+    block->write_cmd_cnt += cnt;
+  }
+  block->write_cnt += cnt;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -121,15 +173,18 @@ const char* block_name(struct block* block) { return block->name; }
 /* Returns BLOCK's type. */
 enum block_type block_type(struct block* block) { return block->type; }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints statistics for each block device used for a Pintos role.
+   Sectors are counted separately from the commands that moved
+   them, so the ratio shows how well transfers are batched. */
 void block_print_stats(void) {
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++) {
     struct block* block = block_by_role[i];
     if (block != NULL) {
-      printf("%s (%s): %llu reads, %llu writes\n", block->name, block_type_name(block->type),
-             block->read_cnt, block->write_cnt);
+      printf("%s (%s): %llu reads in %llu commands, %llu writes in %llu commands\n",
+             block->name, block_type_name(block->type), block->read_cnt, block->read_cmd_cnt,
+             block->write_cnt, block->write_cmd_cnt);
     }
   }
 }
@@ -153,6 +208,8 @@ struct block* block_register(const char* name, enum block_type type, const char*
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->read_cmd_cnt = 0;
+  block->write_cmd_cnt = 0;
 
   printf("%s: %'" PRDSNu " sectors (", block->name, block->size);
   print_human_readable_size((uint64_t)block->size * BLOCK_SECTOR_SIZE);
@@ -34,6 +34,7 @@
 #define STA_BSY 0x80  /* Busy. */
 #define STA_DRDY 0x40 /* Device Ready. */
 #define STA_DRQ 0x08  /* Data Request. */
+#define STA_ERR 0x01  /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04 /* Software Reset. */
@@ -49,6 +50,13 @@
 #define CMD_IDENTIFY_DEVICE 0xec    /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20  /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4      /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5     /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6  /* SET MULTIPLE MODE. */
+
+/* Most sectors a single command can transfer.  The sector count
+   register is 8 bits wide and 0 stands for 256. */
+#define MAX_COMMAND_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk {
@@ -56,6 +64,8 @@ struct ata_disk {
   struct channel* channel; /* Channel that disk is attached to. */
   int dev_no;              /* Device 0 or 1 for master or slave. */
   bool is_ata;             /* Is device an ATA disk? */
+  int multiple;            /* Sectors per interrupt under READ/WRITE MULTIPLE,
+                              0 if the disk does not support them. */
 };
 
 /* An ATA channel (aka controller).
@@ -83,10 +93,12 @@ static void reset_channel(struct channel*);
 static bool check_device_type(struct ata_disk*);
 static void identify_ata_device(struct ata_disk*);
 
-static void select_sector(struct ata_disk*, block_sector_t);
+static int set_multiple_mode(struct ata_disk*, int max);
+static void select_sector(struct ata_disk*, block_sector_t, block_sector_t cnt);
 static void issue_pio_command(struct channel*, uint8_t command);
 static void input_sector(struct channel*, void*);
-static void output_sector(struct channel*, const void*);
+static void input_sectors(struct channel*, void*, block_sector_t cnt);
+static void output_sectors(struct channel*, const void*, block_sector_t cnt);
 
 static void wait_until_idle(const struct ata_disk*);
 static bool wait_while_busy(const struct ata_disk*);
@@ -128,6 +140,7 @@ void ide_init(void) {
       d->channel = c;
       d->dev_no = dev_no;
       d->is_ata = false;
+      d->multiple = 0;
     }
 
     /* Register interrupt handler. */
@@ -277,11 +290,39 @@ static void identify_ata_device(struct ata_disk* d) {
     return;
   }
 
+  /* Word 47 gives the most sectors the disk can move per
+     interrupt under READ/WRITE MULTIPLE. */
+  d->multiple = set_multiple_mode(d, (uint8_t)id[47 * 2]);
+
   /* Register. */
   block = block_register(d->name, BLOCK_RAW, extra_info, capacity, &ide_operations, d);
   partition_scan(block);
 }
 
+/* Asks disk D to transfer MAX sectors per interrupt under
+   READ/WRITE MULTIPLE, or the largest power of 2 below MAX.
+   Returns the block size the disk accepted, or 0 if it does not
+   support multiple mode, in which case transfers fall back to
+   one interrupt per sector. */
+static int set_multiple_mode(struct ata_disk* d, int max) {
+  struct channel* c = d->channel;
+  int cnt = 1;
+
+  if (max < 2)
+    return 0;
+  while (cnt * 2 <= max)
+    cnt *= 2;
+
+  select_device_wait(d);
+  outb(reg_nsect(c), cnt);
+  issue_pio_command(c, CMD_SET_MULTIPLE_MODE);
+  sema_down(&c->completion_wait);
+  wait_while_busy(d);
+  if (inb(reg_status(c)) & STA_ERR)
+    return 0;
+  return cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -306,53 +347,111 @@ static char* descramble_ata_string(char* string, int size) {
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses READ MULTIPLE if D supports it, so that the disk
+   interrupts once per block of D->multiple sectors instead of
+   once per sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_read(void* d_, block_sector_t sec_no, void* buffer) {
+static void ide_read_multiple(void* d_, block_sector_t sec_no, block_sector_t cnt,
+                              void* buffer_) {
   struct ata_disk* d = d_;
   struct channel* c = d->channel;
+  uint8_t* buffer = buffer_;
+
   lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_READ_SECTOR_RETRY);
-  sema_down(&c->completion_wait);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
-  input_sector(c, buffer);
+  while (cnt > 0) {
+    block_sector_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+    block_sector_t per_irq = n > 1 && d->multiple > 0 ? (block_sector_t)d->multiple : 1;
+    block_sector_t done;
+
+    select_sector(d, sec_no, n);
+    issue_pio_command(c, per_irq > 1 ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+    for (done = 0; done < n; done += per_irq) {
+      block_sector_t chunk = n - done < per_irq ? n - done : per_irq;
+      sema_down(&c->completion_wait);
+      if (!wait_while_busy(d))
+        PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no + done);
+      input_sectors(c, buffer, chunk);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+    }
+    sec_no += n;
+    cnt -= n;
+  }
   lock_release(&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Uses WRITE
+   MULTIPLE if D supports it.  Returns after the disk has
    acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_write(void* d_, block_sector_t sec_no, const void* buffer) {
+static void ide_write_multiple(void* d_, block_sector_t sec_no, block_sector_t cnt,
+                               const void* buffer_) {
   struct ata_disk* d = d_;
   struct channel* c = d->channel;
+  const uint8_t* buffer = buffer_;
+
   lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-  output_sector(c, buffer);
-  sema_down(&c->completion_wait);
+  while (cnt > 0) {
+    block_sector_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+    block_sector_t per_irq = n > 1 && d->multiple > 0 ? (block_sector_t)d->multiple : 1;
+    block_sector_t done;
+
+    select_sector(d, sec_no, n);
+    issue_pio_command(c, per_irq > 1 ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+    for (done = 0; done < n; done += per_irq) {
+      block_sector_t chunk = n - done < per_irq ? n - done : per_irq;
+
+      /* The disk asks for every block after the first with an
+         interrupt. */
+      if (done > 0)
+        sema_down(&c->completion_wait);
+      if (!wait_while_busy(d))
+        PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no + done);
+      output_sectors(c, buffer, chunk);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+    }
+    sema_down(&c->completion_wait);
+    sec_no += n;
+    cnt -= n;
+  }
   lock_release(&c->lock);
 }
 
-static struct block_operations ide_operations = {ide_read, ide_write};
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void ide_read(void* d_, block_sector_t sec_no, void* buffer) {
+  ide_read_multiple(d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void ide_write(void* d_, block_sector_t sec_no, const void* buffer) {
+  ide_write_multiple(d_, sec_no, 1, buffer);
+}
+
+static struct block_operations ide_operations = {ide_read, ide_write, ide_read_multiple,
+                                                 ide_write_multiple};
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void select_sector(struct ata_disk* d, block_sector_t sec_no) {
+   writes SEC_NO and CNT to the disk's sector selection
+   registers.  (We use LBA mode.) */
+static void select_sector(struct ata_disk* d, block_sector_t sec_no, block_sector_t cnt) {
   struct channel* c = d->channel;
 
-  ASSERT(sec_no < (1UL << 28));
+  ASSERT(cnt > 0 && cnt <= MAX_COMMAND_SECTORS);
+  ASSERT(sec_no + cnt <= (1UL << 28));
 
   select_device_wait(d);
-  outb(reg_nsect(c), 1);
+  outb(reg_nsect(c), cnt == MAX_COMMAND_SECTORS ? 0 : cnt);
   outb(reg_lbal(c), sec_no);
   outb(reg_lbam(c), sec_no >> 8);
   outb(reg_lbah(c), (sec_no >> 16));
@@ -376,10 +475,17 @@ static void input_sector(struct channel* c, void* sector) {
   insw(reg_data(c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
-static void output_sector(struct channel* c, const void* sector) {
-  outsw(reg_data(c), sector, BLOCK_SECTOR_SIZE / 2);
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void input_sectors(struct channel* c, void* buffer, block_sector_t cnt) {
+  insw(reg_data(c), buffer, cnt * BLOCK_SECTOR_SIZE / 2);
+}
+
+/* Writes CNT sectors from BUFFER to channel C's data register in
+   PIO mode. */
+static void output_sectors(struct channel* c, const void* buffer, block_sector_t cnt) {
+  outsw(reg_data(c), buffer, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL 0x43                        /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL)) /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -44,10 +41,6 @@
    FREQUENCY is the number of periods per second, in Hz. */
 void pit_configure_channel(int channel, int mode, int frequency) {
   uint16_t count;
-  enum intr_level old_level;
-
-  ASSERT(channel == 0 || channel == 2);
-  ASSERT(mode == 2 || mode == 3);
 
   /* Convert FREQUENCY to a PIT counter value.  The PIT has a
      clock that runs at PIT_HZ cycles per second.  We must
@@ -68,10 +61,41 @@ void pit_configure_channel(int channel, int mode, int frequency) {
   } else
     count = (PIT_HZ + frequency / 2) / frequency;
 
-  /* Configure the PIT mode and load its counters. */
+  pit_configure_channel_count(channel, mode, count == 0 ? 65536 : count);
+}
+
+/* Configures CHANNEL like pit_configure_channel(), but with a
+   period of COUNT PIT cycles, between 2 and 65536.  The new
+   period starts right away. */
+void pit_configure_channel_count(int channel, int mode, unsigned count) {
+  enum intr_level old_level;
+
+  ASSERT(channel == 0 || channel == 2);
+  ASSERT(mode == 2 || mode == 3);
+  ASSERT(count >= 2 && count <= 65536);
+
+  /* Configure the PIT mode and load its counters.  A count of
+     65536 is written as 0. */
   old_level = intr_disable();
   outb(PIT_PORT_CONTROL, (channel << 6) | 0x30 | (mode << 1));
   outb(PIT_PORT_COUNTER(channel), count);
   outb(PIT_PORT_COUNTER(channel), count >> 8);
   intr_set_level(old_level);
 }
+
+/* Returns the number of PIT cycles left in CHANNEL's current
+   period. */
+unsigned pit_read_count(int channel) {
+  enum intr_level old_level;
+  unsigned count;
+
+  ASSERT(channel == 0 || channel == 2);
+
+  /* Latch the counter, then read it low byte first. */
+  old_level = intr_disable();
+  outb(PIT_PORT_CONTROL, channel << 6);
+  count = inb(PIT_PORT_COUNTER(channel));
+  count |= inb(PIT_PORT_COUNTER(channel)) << 8;
+  intr_set_level(old_level);
+  return count == 0 ? 65536 : count;
+}
@@ -5,6 +5,9 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
@@ -116,6 +119,9 @@ void shutdown_power_off(void) {
 static void print_stats(void) {
   timer_print_stats();
   thread_print_stats();
+  palloc_print_stats();
+  malloc_print_stats();
+  slab_print_stats();
 #ifdef FILESYS
   block_print_stats();
 #endif
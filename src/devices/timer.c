@@ -7,7 +7,6 @@
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
-#include "filesys/filesys.h"
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -20,13 +19,42 @@
 
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
-static int64_t last_flush_stamp;
+
+/* Sleeping threads, in a hierarchical timing wheel.  Level 0 has
+   a slot for each of the next WHEEL_SLOTS ticks, and each slot of
+   level N covers WHEEL_SLOTS times as many ticks as a slot of
+   level N - 1.  A thread goes into the lowest level that reaches
+   its wake-up tick, so adding and removing one is O(1).  Whenever
+   level 0 wraps around, the next slot of level 1 is emptied into
+   it, and so on up the levels.  Threads due beyond the top level
+   are put in its farthest slot and sorted again when it is
+   emptied. */
+#define WHEEL_BITS 6                   /* Log2 of slots per level. */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)  /* Slots per level. */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)   /* Slot index bits. */
+#define WHEEL_LEVELS 4                 /* Levels, covering 2**24 ticks. */
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static int64_t wheel_ticks; /* Next tick whose slot is due. */
+
+/* PIT cycles per timer tick, and the most ticks that one PIT
+   period can span while the CPU is idle. */
+#define TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define IDLE_TICKS_MAX (65536 / TICK_COUNT)
+
+/* Number of ticks that the next timer interrupt stands for.  This
+   is 1 except when the timer was slowed down by timer_idle(). */
+static int pending_ticks = 1;
+
+/* PIT cycles in the timer's current period.  This is TICK_COUNT
+   except after timer_idle() or timer_wake() changed it. */
+static unsigned pit_period = TICK_COUNT;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static void timer_advance(int elapsed);
 static bool too_many_loops(unsigned loops);
 static void busy_wait(int64_t loops);
 static void real_time_sleep(int64_t num, int32_t denom);
@@ -35,7 +63,11 @@ static void real_time_delay(int64_t num, int32_t denom);
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void timer_init(void) {
-  last_flush_stamp = 0;
+  for (int level = 0; level < WHEEL_LEVELS; level++)
+    for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init(&wheel[level][slot]);
+  wheel_ticks = 1;
+
   pit_configure_channel(0, 2, TIMER_FREQ);
   intr_register_ext(0x20, timer_interrupt, "8254 Timer");
 }
@@ -76,32 +108,135 @@ int64_t timer_ticks(void) {
    should be a value once returned by timer_ticks(). */
 int64_t timer_elapsed(int64_t then) { return timer_ticks() - then; }
 
-// Returns true if a needs to be woken earlier than b
-bool stamp_aux(wake_node* a, wake_node* b) { return a->timestamp < b->timestamp; }
+/* Puts sleeping thread T in the timer wheel slot for its wake-up
+   tick.  Interrupts must be off. */
+static void wheel_insert(struct thread* t) {
+  int64_t when = t->wake_time;
+  int64_t delta = when - wheel_ticks;
+  int level;
 
-// Comparision function for ordered list insertion
-bool wake_list_less(const struct list_elem* a, const struct list_elem* b, void* aux) {
-  return ((bool (*)(wake_node*, wake_node*))(aux))(list_entry(a, wake_node, elem),
-                                                   list_entry(b, wake_node, elem));
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  /* Overdue threads wake at the next tick. */
+  if (delta < 0) {
+    when = wheel_ticks;
+    delta = 0;
+  }
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t)1 << (WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= (int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+    when = wheel_ticks + ((int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  list_push_back(&wheel[level][(when >> (WHEEL_BITS * level)) & WHEEL_MASK], &t->wake_elem);
+}
+
+/* Empties slot SLOT of wheel level LEVEL into the levels below.
+   Returns SLOT. */
+static int wheel_cascade(int level, int slot) {
+  struct list* list = &wheel[level][slot];
+
+  while (!list_empty(list))
+    wheel_insert(list_entry(list_pop_front(list), struct thread, wake_elem));
+  return slot;
+}
+
+/* Wakes the threads due at each tick up to NOW.  Runs in an
+   external interrupt context. */
+static void wheel_advance(int64_t now) {
+  while (wheel_ticks <= now) {
+    int slot = wheel_ticks & WHEEL_MASK;
+    struct list* list = &wheel[0][slot];
+
+    /* Level 0 wrapped around: refill it from the next slot of
+       level 1, and level 1 from level 2 if it wrapped too. */
+    for (int level = 1; slot == 0 && level < WHEEL_LEVELS; level++)
+      slot = wheel_cascade(level, (wheel_ticks >> (WHEEL_BITS * level)) & WHEEL_MASK);
+
+    while (!list_empty(list))
+      thread_unblock(list_entry(list_pop_front(list), struct thread, wake_elem));
+    wheel_ticks++;
+  }
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void timer_sleep(int64_t ticks) {
-  int64_t timestamp = timer_ticks() + ticks;
-  wake_node* new_wake_node = (wake_node*)malloc(sizeof(wake_node));
-  new_wake_node->timestamp = timestamp;
-  new_wake_node->t = thread_current();
-  enum intr_level old_level = intr_disable();
-  list_insert_ordered(get_wake_list(), &new_wake_node->elem, &wake_list_less, (void*)stamp_aux);
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+
+  ASSERT(intr_get_level() == INTR_ON);
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable();
+  cur->wake_time = timer_ticks() + ticks;
+  wheel_insert(cur);
   thread_block();
   intr_set_level(old_level);
-  free(new_wake_node);
-  timestamp = timer_ticks();
-  if (timestamp - last_flush_stamp > 30 * TIMER_FREQ) {
-    last_flush_stamp = timestamp;
-    cache_flush();
-  }
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  No thread is ready to run, so instead of
+   interrupting every tick the timer is slowed down to interrupt
+   at the next tick that has threads to wake or a wheel level to
+   refill, as far as the PIT's counter reaches.  The first timer
+   interrupt after that makes up for the ticks it skipped and
+   puts the timer back to its normal rate.  If another interrupt
+   wakes a thread first, timer_wake() does so instead. */
+void timer_idle(void) {
+  int64_t due;
+  int skip;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  /* Leave the timer alone if it is already slowed down, or if a
+     tick has come in that the new period would hide. */
+  if (pending_ticks > 1 || intr_ext_pending(0x20))
+    return;
+
+  for (due = wheel_ticks; due < wheel_ticks + IDLE_TICKS_MAX - 1; due++)
+    if ((due & WHEEL_MASK) == 0 || !list_empty(&wheel[0][due & WHEEL_MASK]))
+      break;
+  skip = due - wheel_ticks;
+  if (skip == 0)
+    return;
+
+  /* Stretch the current period, keeping what is left of it. */
+  pit_period = pit_read_count(0) + skip * TICK_COUNT;
+  pit_configure_channel_count(0, 2, pit_period);
+  pending_ticks = skip + 1;
+}
+
+/* Called by thread_unblock() from an interrupt handler, with
+   interrupts off.  If timer_idle() slowed the timer down, counts
+   the ticks that have passed since and shortens the current
+   period to end at the next tick, so that the thread being woken
+   sees the right timer_ticks() and is preempted on time. */
+void timer_wake(void) {
+  unsigned left;
+  int elapsed;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(intr_context());
+
+  if (pending_ticks == 1)
+    return;
+
+  /* The stretched period ends on a tick, and the ticks before it
+     are TICK_COUNT cycles apart.  If it has already ended, the
+     timer interrupt is on its way and does all of this itself. */
+  left = pit_read_count(0);
+  if (intr_ext_pending(0x20))
+    return;
+  elapsed = pending_ticks - DIV_ROUND_UP(left, TICK_COUNT);
+  pending_ticks = 1;
+
+  pit_period = (left - 1) % TICK_COUNT + 1;
+  if (pit_period < 2)
+    pit_period = 2;
+  pit_configure_channel_count(0, 2, pit_period);
+  timer_advance(elapsed);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -148,8 +283,23 @@ void timer_print_stats(void) { printf("Timer: %" PRId64 " ticks\n", timer_ticks(
 
 /* Timer interrupt handler. */
 static void timer_interrupt(struct intr_frame* args UNUSED) {
-  ticks++;
-  thread_tick();
+  int elapsed = pending_ticks;
+
+  pending_ticks = 1;
+  if (pit_period != TICK_COUNT) {
+    pit_configure_channel(0, 2, TIMER_FREQ);
+    pit_period = TICK_COUNT;
+  }
+  timer_advance(elapsed);
+}
+
+/* Counts ELAPSED timer ticks, waking the threads due in them. */
+static void timer_advance(int elapsed) {
+  while (elapsed-- > 0) {
+    ticks++;
+    wheel_advance(ticks);
+    thread_tick();
+  }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -16,8 +16,6 @@ int64_t timer_elapsed(int64_t);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep(int64_t ticks);
-bool stamp_aux(wake_node* a, wake_node* b);
-bool wake_list_less(const struct list_elem* a, const struct list_elem* b, void* aux);
 void timer_msleep(int64_t milliseconds);
 void timer_usleep(int64_t microseconds);
 void timer_nsleep(int64_t nanoseconds);
@@ -27,6 +25,8 @@ void timer_mdelay(int64_t milliseconds);
 void timer_udelay(int64_t microseconds);
 void timer_ndelay(int64_t nanoseconds);
 
+void timer_idle(void);
+void timer_wake(void);
 void timer_print_stats(void);
 
 #endif /* devices/timer.h */
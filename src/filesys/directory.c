@@ -1,18 +1,50 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include <stdlib.h>
 #include "threads/thread.h"
 #include "userprog/process.h"
 
+/* Directory layouts, as recorded in the directory's inode.
+
+   A linear directory is an array of entries packed end to end,
+   searched front to back.
+
+   A hashed directory is an array of buckets, one per sector,
+   each holding BUCKET_ENTRIES entries.  A name lives in bucket
+   hash(name) % bucket count, so a lookup reads one sector.  When
+   a bucket fills up the directory is rehashed into twice as many
+   buckets.  Linear directories are converted the first time an
+   entry is added to them. */
+#define DIR_LINEAR 0
+#define DIR_HASHED 1
+
+/* Most buckets a hashed directory may grow to. */
+#define DIR_MAX_BUCKETS 4096
+
+/* Names remembered by each open directory. */
+#define DIR_CACHE_SIZE 8
+
+/* A name recently looked up in an open directory. */
+struct dir_cache_entry {
+  char name[NAME_MAX + 1];     /* Name, or empty if the slot is unused. */
+  block_sector_t inode_sector; /* Sector number of the name's inode. */
+  off_t ofs;                   /* Byte offset of the name's entry. */
+};
+
 /* A directory. */
 struct dir {
   struct inode* inode; /* Backing store. */
   off_t pos;           /* Current position. */
+  unsigned version;    /* inode_version() when CACHE was last valid. */
+  struct dir_cache_entry cache[DIR_CACHE_SIZE]; /* Recent lookups. */
 };
 
 /* A single directory entry. */
@@ -22,23 +54,203 @@ struct dir_entry {
   bool in_use;                 /* In use or free? */
 };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Entries in one bucket of a hashed directory. */
+#define BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof(struct dir_entry))
+
+/* Dentry cache.
+
+   Remembers the outcome of recent name lookups across all
+   directories, keyed by the parent directory's inode sector and
+   the name, so that resolving a path does not have to read every
+   directory along it.  A negative entry records that a name does
+   not exist.  dir_add() and dir_remove() keep the entries for
+   the names they change up to date, and dir_create() forgets
+   everything cached under a sector that is being reused. */
+#define DENTRY_CACHE_SIZE 256
+
+/* inode_sector of a negative dentry, and parent of an unused one. */
+#define NO_SECTOR ((block_sector_t)-1)
+
+/* A cached lookup result. */
+struct dentry {
+  struct hash_elem hash_elem;  /* Element in dentry_index. */
+  struct list_elem lru_elem;   /* Element in dentry_lru. */
+  block_sector_t parent;       /* Directory's inode sector, or NO_SECTOR if unused. */
+  char name[NAME_MAX + 1];     /* Name within PARENT. */
+  block_sector_t inode_sector; /* NAME's inode sector, or NO_SECTOR if absent. */
+};
+
+static struct dentry dentries[DENTRY_CACHE_SIZE];
+static struct hash dentry_index; /* Dentries in use. */
+static struct list dentry_lru;   /* All dentries, most recently used first. */
+static struct lock dentry_lock;  /* Protects the dentry cache. */
+
+/* Cache of `struct dir's. */
+static struct kmem_cache* dir_cache;
+
+/* Hashes a dentry by parent and name. */
+static unsigned dentry_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct dentry* d = hash_entry(e, struct dentry, hash_elem);
+  return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+/* Orders dentries by parent, then name. */
+static bool dentry_less(const struct hash_elem* a_, const struct hash_elem* b_, void* aux UNUSED) {
+  const struct dentry* a = hash_entry(a_, struct dentry, hash_elem);
+  const struct dentry* b = hash_entry(b_, struct dentry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp(a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void dir_init(void) {
+  size_t i;
+
+  if (!hash_init(&dentry_index, dentry_hash, dentry_less, NULL))
+    PANIC("dentry cache allocation failed");
+  list_init(&dentry_lru);
+  lock_init(&dentry_lock);
+  for (i = 0; i < DENTRY_CACHE_SIZE; i++) {
+    dentries[i].parent = NO_SECTOR;
+    list_push_back(&dentry_lru, &dentries[i].lru_elem);
+  }
+  dir_cache = kmem_cache_create("dir", sizeof(struct dir), NULL);
+  if (dir_cache == NULL)
+    PANIC("directory cache allocation failed");
+}
+
+/* Returns the dentry for NAME in PARENT, or a null pointer if
+   there is none.  The dentry lock must be held. */
+static struct dentry* dentry_find(block_sector_t parent, const char* name) {
+  struct dentry key;
+  struct hash_elem* e;
+
+  key.parent = parent;
+  strlcpy(key.name, name, sizeof key.name);
+  e = hash_find(&dentry_index, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct dentry, hash_elem) : NULL;
+}
+
+/* Drops dentry D from the index and makes it the first to be
+   reused.  The dentry lock must be held. */
+static void dentry_drop(struct dentry* d) {
+  hash_delete(&dentry_index, &d->hash_elem);
+  d->parent = NO_SECTOR;
+  list_remove(&d->lru_elem);
+  list_push_back(&dentry_lru, &d->lru_elem);
+}
+
+/* Looks NAME in PARENT up in the dentry cache.  If it is cached,
+   sets *SECTORP to its inode sector, or to NO_SECTOR if NAME is
+   known not to exist, and returns true. */
+static bool dentry_get(block_sector_t parent, const char* name, block_sector_t* sectorp) {
+  struct dentry* d;
+
+  if (strlen(name) > NAME_MAX)
+    return false;
+  lock_acquire(&dentry_lock);
+  d = dentry_find(parent, name);
+  if (d != NULL) {
+    *sectorp = d->inode_sector;
+    list_remove(&d->lru_elem);
+    list_push_front(&dentry_lru, &d->lru_elem);
+  }
+  lock_release(&dentry_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in directory DIR has its inode at SECTOR,
+   or does not exist if SECTOR is NO_SECTOR, reusing the least
+   recently used dentry if NAME is not cached yet.  If VERSION is
+   not DIR's current inode_version(), DIR changed while the
+   caller was looking NAME up, so nothing is recorded. */
+static void dentry_put(struct dir* dir, const char* name, block_sector_t sector, unsigned version) {
+  block_sector_t parent = inode_get_inumber(dir->inode);
+  struct dentry* d;
+
+  if (strlen(name) > NAME_MAX)
+    return;
+  lock_acquire(&dentry_lock);
+  if (inode_version(dir->inode) == version) {
+    d = dentry_find(parent, name);
+    if (d == NULL) {
+      d = list_entry(list_back(&dentry_lru), struct dentry, lru_elem);
+      if (d->parent != NO_SECTOR)
+        hash_delete(&dentry_index, &d->hash_elem);
+      d->parent = parent;
+      strlcpy(d->name, name, sizeof d->name);
+      hash_insert(&dentry_index, &d->hash_elem);
+    }
+    d->inode_sector = sector;
+    list_remove(&d->lru_elem);
+    list_push_front(&dentry_lru, &d->lru_elem);
+  }
+  lock_release(&dentry_lock);
+}
+
+/* Forgets every dentry whose parent is SECTOR. */
+static void dentry_purge(block_sector_t sector) {
+  size_t i;
+
+  lock_acquire(&dentry_lock);
+  for (i = 0; i < DENTRY_CACHE_SIZE; i++)
+    if (dentries[i].parent == sector)
+      dentry_drop(&dentries[i]);
+  lock_release(&dentry_lock);
+}
+
+/* Creates a hashed directory with space for at least ENTRY_CNT
+   entries in the given SECTOR.  Returns true if successful,
+   false on failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt) {
-  return inode_create(sector, entry_cnt * sizeof(struct dir_entry), true);
+  size_t buckets = entry_cnt > 0 ? DIV_ROUND_UP(entry_cnt, BUCKET_ENTRIES) : 1;
+  struct inode* inode;
+
+  /* SECTOR may have held a directory whose names are cached. */
+  dentry_purge(sector);
+
+  if (!inode_create(sector, buckets * BLOCK_SECTOR_SIZE, true))
+    return false;
+  inode = inode_open(sector);
+  if (inode == NULL)
+    return false;
+  inode_set_dir_format(inode, DIR_HASHED);
+  inode_close(inode);
+  return true;
+}
+
+/* Returns true if DIR uses the hashed layout. */
+static bool dir_is_hashed(const struct dir* dir) {
+  return inode_dir_format(dir->inode) == DIR_HASHED;
+}
+
+/* Returns the number of buckets in hashed directory DIR. */
+static size_t dir_buckets(const struct dir* dir) {
+  return inode_length(dir->inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the byte offset of the entry that follows the one at
+   OFS in a directory with the given layout.  Hashed directories
+   leave the tail of each sector unused. */
+static off_t next_entry_ofs(bool hashed, off_t ofs) {
+  ofs += sizeof(struct dir_entry);
+  if (hashed && ofs % BLOCK_SECTOR_SIZE + sizeof(struct dir_entry) > BLOCK_SECTOR_SIZE)
+    ofs = ROUND_UP(ofs, BLOCK_SECTOR_SIZE);
+  return ofs;
 }
 
 /* Opens and returns the directory for the given INODE, of which
    it takes ownership.  Returns a null pointer on failure. */
 struct dir* dir_open(struct inode* inode) {
-  struct dir* dir = calloc(1, sizeof *dir);
+  struct dir* dir = kmem_cache_zalloc(dir_cache);
   if (inode != NULL && dir != NULL) {
     dir->inode = inode;
     dir->pos = 0;
     return dir;
   } else {
     inode_close(inode);
-    free(dir);
+    kmem_cache_free(dir_cache, dir);
     return NULL;
   }
 }
@@ -59,7 +271,7 @@ struct dir* dir_reopen(struct dir* dir) {
 void dir_close(struct dir* dir) {
   if (dir != NULL) {
     inode_close(dir->inode);
-    free(dir);
+    kmem_cache_free(dir_cache, dir);
   }
 }
 
@@ -68,45 +280,236 @@ struct inode* dir_get_inode(struct dir* dir) {
   return dir->inode;
 }
 
+/* Returns true if E is an in-use entry named NAME. */
+static bool entry_has_name(const struct dir_entry* e, const void* name) {
+  return e->in_use && !strcmp(name, e->name);
+}
+
+/* Returns true if E is a free slot. */
+static bool entry_is_free(const struct dir_entry* e, const void* aux UNUSED) { return !e->in_use; }
+
+/* Walks linear directory DIR's entries in order, examining each
+   one in place in the buffer cache rather than copying it out,
+   until MATCH
+   returns true for one of them.  On a match, copies the entry
+   into *EP if EP is non-null, sets *OFSP to its byte offset and
+   returns true.  Otherwise sets *OFSP to the offset just past
+   the last whole entry and returns false.  Entries that
+   straddle a sector boundary are read with inode_read_at(). */
+static bool scan_entries(const struct dir* dir,
+                         bool (*match)(const struct dir_entry*, const void* aux), const void* aux,
+                         struct dir_entry* ep, off_t* ofsp) {
+  struct inode* inode = dir->inode;
+  off_t length = inode_length(inode);
+  off_t ofs = 0;
+
+  while (ofs + (off_t)sizeof(struct dir_entry) <= length) {
+    off_t sector_end = ROUND_UP(ofs + 1, BLOCK_SECTOR_SIZE);
+
+    if (ofs + (off_t)sizeof(struct dir_entry) > sector_end) {
+      struct dir_entry e;
+      if (inode_read_at(inode, &e, sizeof e, ofs) != sizeof e)
+        break;
+      if (match(&e, aux)) {
+        if (ep != NULL)
+          *ep = e;
+        *ofsp = ofs;
+        return true;
+      }
+      ofs += sizeof e;
+      continue;
+    }
+
+    off_t limit = sector_end < length ? sector_end : length;
+    const uint8_t* sector = inode_pin_at(inode, ofs);
+    if (sector == NULL)
+      break;
+    for (; ofs + (off_t)sizeof(struct dir_entry) <= limit; ofs += sizeof(struct dir_entry)) {
+      const struct dir_entry* e = (const struct dir_entry*)(sector + ofs % BLOCK_SECTOR_SIZE);
+      if (match(e, aux)) {
+        if (ep != NULL)
+          *ep = *e;
+        *ofsp = ofs;
+        inode_unpin(sector);
+        return true;
+      }
+    }
+    inode_unpin(sector);
+  }
+  *ofsp = ofs;
+  return false;
+}
+
+/* Examines the entries of bucket BUCKET of hashed directory DIR
+   in place until MATCH returns true for one of them.  On a
+   match, copies the entry into *EP if EP is non-null, sets *OFSP
+   to its byte offset and returns true.  Otherwise returns
+   false. */
+static bool scan_bucket(const struct dir* dir, size_t bucket,
+                        bool (*match)(const struct dir_entry*, const void* aux), const void* aux,
+                        struct dir_entry* ep, off_t* ofsp) {
+  off_t base = bucket * BLOCK_SECTOR_SIZE;
+  const uint8_t* sector = inode_pin_at(dir->inode, base);
+  size_t i;
+
+  if (sector == NULL)
+    return false;
+  for (i = 0; i < BUCKET_ENTRIES; i++) {
+    const struct dir_entry* e = (const struct dir_entry*)(sector + i * sizeof *e);
+    if (match(e, aux)) {
+      if (ep != NULL)
+        *ep = *e;
+      *ofsp = base + i * sizeof *e;
+      inode_unpin(sector);
+      return true;
+    }
+  }
+  inode_unpin(sector);
+  return false;
+}
+
+/* Rewrites DIR as a hashed directory of at least BUCKETS
+   buckets, doubling the count until every entry fits in its
+   bucket.  Converts linear directories.  Returns true if
+   successful, false if memory or disk space runs out or the
+   directory would exceed DIR_MAX_BUCKETS buckets. */
+static bool dir_rehash(struct dir* dir, size_t buckets) {
+  struct inode* inode = dir->inode;
+  bool hashed = dir_is_hashed(dir);
+  off_t length = inode_length(inode);
+  uint8_t* old = malloc(length > 0 ? length : 1);
+  uint8_t* table = NULL;
+  bool success = false;
+
+  if (old == NULL || inode_read_at(inode, old, length, 0) != length)
+    goto done;
+
+  /* The new table must cover the old contents completely. */
+  if (buckets < (size_t)DIV_ROUND_UP(length, BLOCK_SECTOR_SIZE))
+    buckets = DIV_ROUND_UP(length, BLOCK_SECTOR_SIZE);
+
+  for (;;) {
+    bool overflow = false;
+    off_t ofs;
+
+    if (buckets > DIR_MAX_BUCKETS)
+      goto done;
+    table = calloc(buckets, BLOCK_SECTOR_SIZE);
+    if (table == NULL)
+      goto done;
+    for (ofs = 0; !overflow && ofs + (off_t)sizeof(struct dir_entry) <= length;
+         ofs = next_entry_ofs(hashed, ofs)) {
+      const struct dir_entry* e = (const struct dir_entry*)(old + ofs);
+      if (e->in_use) {
+        uint8_t* bucket = table + hash_string(e->name) % buckets * BLOCK_SECTOR_SIZE;
+        size_t i;
+        for (i = 0; i < BUCKET_ENTRIES; i++)
+          if (!((struct dir_entry*)(bucket + i * sizeof *e))->in_use)
+            break;
+        if (i == BUCKET_ENTRIES)
+          overflow = true;
+        else
+          memcpy(bucket + i * sizeof *e, e, sizeof *e);
+      }
+    }
+    if (!overflow)
+      break;
+    free(table);
+    table = NULL;
+    buckets *= 2;
+  }
+
+  success = inode_write_at(inode, table, buckets * BLOCK_SECTOR_SIZE, 0) ==
+            (off_t)(buckets * BLOCK_SECTOR_SIZE);
+  if (success && !hashed)
+    inode_set_dir_format(inode, DIR_HASHED);
+
+done:
+  free(table);
+  free(old);
+  return success;
+}
+
+/* Returns DIR's cache slot for NAME, first forgetting every
+   cached name if DIR's inode has been written since they were
+   cached. */
+static struct dir_cache_entry* dir_cache_slot(struct dir* dir, const char* name) {
+  unsigned version = inode_version(dir->inode);
+  if (dir->version != version) {
+    size_t i;
+    for (i = 0; i < DIR_CACHE_SIZE; i++)
+      dir->cache[i].name[0] = '\0';
+    dir->version = version;
+  }
+  return &dir->cache[hash_string(name) % DIR_CACHE_SIZE];
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
    otherwise, returns false and ignores EP and OFSP. */
-static bool lookup(const struct dir* dir, const char* name, struct dir_entry* ep, off_t* ofsp) {
+static bool lookup(struct dir* dir, const char* name, struct dir_entry* ep, off_t* ofsp) {
+  struct dir_cache_entry* c;
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs;
+  bool found;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
   if (dir->inode == NULL) {
     return false;
   }
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-    if (e.in_use && !strcmp(name, e.name)) {
-      if (ep != NULL)
-        *ep = e;
-      if (ofsp != NULL)
-        *ofsp = ofs;
-      return true;
-    }
-  return false;
+
+  c = dir_cache_slot(dir, name);
+  if (c->name[0] != '\0' && !strcmp(c->name, name)) {
+    e.inode_sector = c->inode_sector;
+    strlcpy(e.name, c->name, sizeof e.name);
+    e.in_use = true;
+    ofs = c->ofs;
+  } else {
+    if (dir_is_hashed(dir)) {
+      size_t buckets = dir_buckets(dir);
+      found = buckets > 0 &&
+              scan_bucket(dir, hash_string(name) % buckets, entry_has_name, name, &e, &ofs);
+    } else
+      found = scan_entries(dir, entry_has_name, name, &e, &ofs);
+    if (!found)
+      return false;
+    strlcpy(c->name, e.name, sizeof c->name);
+    c->inode_sector = e.inode_sector;
+    c->ofs = ofs;
+  }
+
+  if (ep != NULL)
+    *ep = e;
+  if (ofsp != NULL)
+    *ofsp = ofs;
+  return true;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
    a null pointer.  The caller must close *INODE. */
-bool dir_lookup(const struct dir* dir, const char* name, struct inode** inode) {
+bool dir_lookup(struct dir* dir, const char* name, struct inode** inode) {
   struct dir_entry e;
+  block_sector_t sector;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
-  if (lookup(dir, name, &e, NULL)) {
-    *inode = inode_open(e.inode_sector);
-  } else
-    *inode = NULL;
+  *inode = NULL;
+  if (dir->inode == NULL)
+    return false;
+
+  if (!dentry_get(inode_get_inumber(dir->inode), name, &sector)) {
+    unsigned version = inode_version(dir->inode);
+    sector = lookup(dir, name, &e, NULL) ? e.inode_sector : NO_SECTOR;
+    dentry_put(dir, name, sector, version);
+  }
+  if (sector != NO_SECTOR)
+    *inode = inode_open(sector);
 
   return *inode != NULL;
 }
@@ -130,20 +533,20 @@ bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
     return false;
 
   /* Check that NAME is not in use. */
-  if (lookup(dir, name, NULL, NULL))
+  if (dir->inode == NULL || lookup(dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  if (dir->inode != NULL) {
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-      if (!e.in_use)
-        break;
+  /* Set OFS to a free slot in NAME's bucket, converting DIR to
+     the hashed layout or growing it as needed. */
+  if (!dir_is_hashed(dir) && !dir_rehash(dir, 1))
+    goto done;
+  for (;;) {
+    size_t buckets = dir_buckets(dir);
+    if (buckets > 0 &&
+        scan_bucket(dir, hash_string(name) % buckets, entry_is_free, NULL, NULL, &ofs))
+      break;
+    if (!dir_rehash(dir, buckets > 0 ? buckets * 2 : 1))
+      goto done;
   }
 
   /* Write slot. */
@@ -151,6 +554,8 @@ bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
   strlcpy(e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dentry_put(dir, name, inode_sector, inode_version(dir->inode));
 
 done:
   return success;
@@ -182,6 +587,10 @@ bool dir_remove(struct dir* dir, const char* name) {
   if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
 
+  dentry_put(dir, name, NO_SECTOR, inode_version(dir->inode));
+  if (inode_is_dir(inode))
+    dentry_purge(e.inode_sector);
+
   /* Remove inode. */
   inode_remove(inode);
   success = true;
@@ -193,13 +602,15 @@ done:
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  "." and ".." are skipped, since in
+   a hashed directory they are not necessarily the first two
+   entries. */
 bool dir_readdir(struct dir* dir, char name[NAME_MAX + 1]) {
   struct dir_entry e;
 
   while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
-    dir->pos += sizeof e;
-    if (e.in_use) {
+    dir->pos = next_entry_ofs(dir_is_hashed(dir), dir->pos);
+    if (e.in_use && strcmp(e.name, ".") && strcmp(e.name, "..")) {
       strlcpy(name, e.name, NAME_MAX + 1);
       return true;
     }
@@ -240,20 +651,20 @@ static int get_next_part(char part[NAME_MAX + 1], const char** srcp) {
 struct dir* get_dir_at_path(const char* dir, struct dir* cwd) {
   struct dir* directory;
   struct dir* next_directory;
+  struct inode* next_inode;
   if (dir[0] == '/')
     directory = dir_open_root();
   else
     directory = cwd;
   char part[NAME_MAX + 1];
   int res = get_next_part(part, &dir);
-  next_directory = malloc(sizeof(struct dir));
   while (res != 0) {
-    if (!dir_lookup(directory, part, &(next_directory->inode))) {
+    if (!dir_lookup(directory, part, &next_inode)) {
       if (directory != cwd)
         dir_close(directory);
       return NULL;
     }
-    next_directory = dir_open(next_directory->inode);
+    next_directory = dir_open(next_inode);
     if (directory != cwd)
       dir_close(directory);
     directory = next_directory;
@@ -318,7 +729,7 @@ bool filesys_remove(const char* name) {
     for (; dir_readdir(temp, useless); i++) {
     }
     dir_close(temp);
-    if (inode_is_open(*to_remove) || i > 2) {
+    if (inode_is_open(*to_remove) || i > 0) {
       dir_close(dir);
       return false;
     }
@@ -388,8 +799,9 @@ bool mk_dir(const char* new_dir_path, struct dir* cwd) {
   given that one exists. Optionally, it takes in a cwd to support 
   relative paths. */
 struct dir* ch_dir(const char* dir, struct dir* cwd) {
-  struct dir* directory = malloc(sizeof(struct dir));
-  struct dir* next_directory = malloc(sizeof(struct dir));
+  struct dir* directory;
+  struct dir* next_directory;
+  struct inode* next_inode;
   if (dir[0] == '/')
     directory = dir_open_root();
   else
@@ -397,12 +809,12 @@ struct dir* ch_dir(const char* dir, struct dir* cwd) {
   char part[NAME_MAX + 1];
   int res = get_next_part(part, &dir);
   while (res != 0) {
-    if (!dir_lookup(directory, part, &next_directory->inode)) {
+    if (!dir_lookup(directory, part, &next_inode)) {
       if (directory != cwd)
         dir_close(directory);
       return NULL;
     }
-    next_directory = dir_open(next_directory->inode);
+    next_directory = dir_open(next_inode);
     if (directory != cwd)
       dir_close(directory);
     directory = next_directory;
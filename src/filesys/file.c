@@ -1,28 +1,44 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/interrupt.h"
+#include "threads/slab.h"
 
 /* An open file. */
 struct file {
   struct inode* inode; /* File's inode. */
   off_t pos;           /* Current position. */
   bool deny_write;     /* Has file_deny_write() been called? */
+  off_t ra_next;       /* Position a sequential read would start at. */
+  off_t ra_issued;     /* End of the range already queued for read-ahead. */
+  int ref_cnt;         /* References; closed when the last is dropped. */
 };
 
+/* Cache of `struct file's. */
+static struct kmem_cache* file_cache;
+
+/* Initializes the file module. */
+void file_init(void) {
+  file_cache = kmem_cache_create("file", sizeof(struct file), NULL);
+  if (file_cache == NULL)
+    PANIC("file cache allocation failed");
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file* file_open(struct inode* inode) {
-  struct file* file = calloc(1, sizeof *file);
+  struct file* file = kmem_cache_zalloc(file_cache);
   if (inode != NULL && file != NULL) {
     file->inode = inode;
     file->pos = 0;
     file->deny_write = false;
+    file->ra_next = file->ra_issued = 0;
+    file->ref_cnt = 1;
     return file;
   } else {
     inode_close(inode);
-    free(file);
+    kmem_cache_free(file_cache, file);
     return NULL;
   }
 }
@@ -33,12 +49,28 @@ struct file* file_reopen(struct file* file) {
   return file_open(inode_reopen(file->inode));
 }
 
-/* Closes FILE. */
+/* Adds a reference to FILE and returns FILE.  The reference is
+   dropped with file_close(), and FILE, including its position,
+   stays open until every reference has been. */
+struct file* file_hold(struct file* file) {
+  enum intr_level old_level = intr_disable();
+  file->ref_cnt++;
+  intr_set_level(old_level);
+  return file;
+}
+
+/* Drops a reference to FILE, closing it if that was the last. */
 void file_close(struct file* file) {
   if (file != NULL) {
+    enum intr_level old_level = intr_disable();
+    bool last = --file->ref_cnt == 0;
+    intr_set_level(old_level);
+    if (!last)
+      return;
+
     file_allow_write(file);
     inode_close(file->inode);
-    free(file);
+    kmem_cache_free(file_cache, file);
   }
 }
 
@@ -51,10 +83,16 @@ struct inode* file_get_inode(struct file* file) {
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+   If the read continues where the previous one left off, asks
+   for the sectors that follow to be read ahead. */
 off_t file_read(struct file* file, void* buffer, off_t size) {
+  bool sequential = file->pos == file->ra_next;
   off_t bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_next = file->pos;
+  if (sequential && bytes_read > 0)
+    file->ra_issued = inode_read_ahead(file->inode, file->pos, file->ra_issued);
   return bytes_read;
 }
 
@@ -124,6 +162,7 @@ void file_seek(struct file* file, off_t new_pos) {
   ASSERT(file != NULL);
   ASSERT(new_pos >= 0);
   file->pos = new_pos;
+  file->ra_issued = 0;
 }
 
 /* Returns the current position in FILE as a byte offset from the
@@ -1,11 +1,18 @@
 #include "filesys/filesys.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Partition that contains the file system. */
 struct block* fs_device;
@@ -13,31 +20,43 @@ struct block* fs_device;
 /* Sector cache. */
 struct sector_cache* s_cache;
 
+/* A dirty slot picked for write-behind, with its sector and age
+   copied out so that sorting does not race with cache users. */
+struct flush_item {
+  size_t slot;
+  block_sector_t sector;
+  int64_t dirty_since;
+};
+
+/* Scratch array of one flush_item per cache slot, used only by
+   the flusher thread. */
+static struct flush_item* flush_batch;
+
+/* Most adjacent sectors moved to or from disk in one command by
+   the background threads, and the bounce buffers that gather
+   them, one per thread. */
+#define CACHE_MAX_RUN (PGSIZE / BLOCK_SECTOR_SIZE)
+static char flush_bounce[CACHE_MAX_RUN * BLOCK_SECTOR_SIZE];
+static char read_ahead_bounce[CACHE_MAX_RUN * BLOCK_SECTOR_SIZE];
+
 static void do_format(void);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
-void filesys_init(bool format) {
-  /* Sector cache setup */
-  s_cache = (struct sector_cache*)malloc(sizeof(struct sector_cache));
-  s_cache->dirty_bitmap = s_cache->clock_bitmap = s_cache->valid_bitmap = 0;
-  s_cache->hits = s_cache->misses = 0;
-  s_cache->last_evict = -1;
-  lock_init(&(s_cache->global_lock));
-  s_cache->sector_list = (sector_node**)malloc(sizeof(sector_node*) * 64);
-  s_cache->sector_locks = (struct lock**)malloc(sizeof(struct lock*) * 64);
-  for (int i = 0; i < 64; i++) {
-    s_cache->sector_list[i] = (sector_node*)malloc(sizeof(sector_node));
-    s_cache->sector_locks[i] = (struct lock*)malloc(sizeof(struct lock));
-    lock_init(s_cache->sector_locks[i]);
-  }
-  /* End of sector cache setup */
+   If FORMAT is true, reformats the file system.
+   The buffer cache holds CACHE_SECTORS sectors and prefetches
+   READ_AHEAD_SECTORS sectors ahead of sequential readers. */
+void filesys_init(bool format, size_t cache_sectors, size_t read_ahead_sectors) {
   fs_device = block_get_role(BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC("No file system device found, can't initialize file system.");
 
+  /* The cache's flusher thread flushes the free map, so the free
+     map must exist before the cache starts. */
   inode_init();
+  file_init();
+  dir_init();
   free_map_init();
+  cache_init(cache_sectors, read_ahead_sectors);
 
   if (format)
     do_format();
@@ -48,8 +67,8 @@ void filesys_init(bool format) {
 /* Shuts down the file system module, writing any unwritten data
    to disk. */
 void filesys_done(void) {
-  cache_flush();
   free_map_close();
+  cache_flush();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -110,10 +129,122 @@ struct file* filesys_open_dir(const char* name, struct dir* dir) {
   return file_open(inode);
 }
 
+/* Hashes a cache slot by its sector number. */
+static unsigned sector_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, sector_node, hash_elem)->sector);
+}
+
+/* Orders cache slots by sector number, counting the comparison. */
+static bool sector_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  s_cache->compares++;
+  return hash_entry(a, sector_node, hash_elem)->sector <
+         hash_entry(b, sector_node, hash_elem)->sector;
+}
+
+static void read_ahead_daemon(void* aux);
+static void flusher_daemon(void* aux);
+
+/* Sets up a sector cache with room for SECTORS sectors.  The
+   slot buffers are carved out of whole pages so that large
+   caches do not waste half of every 1 kB malloc block.  Starts
+   the read-ahead thread, which prefetches up to READ_AHEAD
+   sectors past a sequential reader, and the flusher thread,
+   which writes dirty sectors back in the background. */
+void cache_init(size_t sectors, size_t read_ahead) {
+  size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+
+  if (sectors == 0)
+    sectors = CACHE_DEFAULT_SECTORS;
+  ASSERT(sectors >= CACHE_MIN_SECTORS);
+  s_cache = malloc(sizeof(struct sector_cache));
+  if (s_cache == NULL)
+    PANIC("sector cache allocation failed");
+  s_cache->hits = s_cache->misses = 0;
+  s_cache->size = sectors;
+  s_cache->clock_hand = 0;
+  s_cache->dirty_cnt = 0;
+  lock_init(&s_cache->flush_lock);
+  cond_init(&s_cache->flush_ready);
+  s_cache->flusher_idle = false;
+  s_cache->evict_waiters = 0;
+  lock_init(&s_cache->evict_lock);
+  cond_init(&s_cache->slot_freed);
+  lock_init(&s_cache->global_lock);
+  lock_init(&s_cache->index_lock);
+  s_cache->sector_list = calloc(sectors, sizeof(sector_node));
+  s_cache->buffers = palloc_get_multiple(0, DIV_ROUND_UP(sectors, per_page));
+  flush_batch = malloc(sectors * sizeof *flush_batch);
+  if (s_cache->sector_list == NULL || s_cache->buffers == NULL || flush_batch == NULL ||
+      !hash_init(&s_cache->index, sector_hash, sector_less, NULL))
+    PANIC("sector cache allocation failed--%zu sectors is too many", sectors);
+  for (size_t i = 0; i < sectors; i++) {
+    sector_node* entry = &s_cache->sector_list[i];
+    lock_init(&entry->lock);
+    entry->buf = s_cache->buffers + i * BLOCK_SECTOR_SIZE;
+  }
+
+  s_cache->ra_hits = s_cache->ra_misses = 0;
+  s_cache->compares = 0;
+  s_cache->lookups = s_cache->lookup_compares = 0;
+  s_cache->ra_window = read_ahead;
+  s_cache->ra_head = s_cache->ra_count = 0;
+  lock_init(&s_cache->ra_lock);
+  cond_init(&s_cache->ra_ready);
+  if (read_ahead > 0 &&
+      thread_create("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL) == TID_ERROR)
+    PANIC("read-ahead thread creation failed");
+  if (thread_create("flusher", PRI_MIN, flusher_daemon, NULL) == TID_ERROR)
+    PANIC("flusher thread creation failed");
+}
+
 /* Writes the data from entry to the correct sector on disk. */
 void write_entry_to_disk(int position) {
-  block_write(fs_device, s_cache->sector_list[position]->sector,
-              s_cache->sector_list[position]->buf);
+  block_write(fs_device, s_cache->sector_list[position].sector,
+              s_cache->sector_list[position].buf);
+}
+
+/* Marks ENTRY, which the caller has locked, as modified. */
+static void mark_dirty(sector_node* entry) {
+  if (!entry->dirty) {
+    enum intr_level old_level;
+
+    entry->dirty = true;
+    entry->dirty_since = timer_ticks();
+    old_level = intr_disable();
+    s_cache->dirty_cnt++;
+    intr_set_level(old_level);
+    cache_wake_flusher();
+  }
+}
+
+/* Marks ENTRY, which the caller has locked and which has just
+   been written back, as clean. */
+static void mark_clean(sector_node* entry) {
+  enum intr_level old_level;
+
+  ASSERT(entry->valid && entry->dirty);
+  entry->dirty = false;
+  old_level = intr_disable();
+  s_cache->dirty_cnt--;
+  intr_set_level(old_level);
+}
+
+/* Unlocks ENTRY and wakes any threads waiting in cache_evict()
+   for a slot to come free. */
+static void cache_release(sector_node* entry) {
+  lock_release(&entry->lock);
+  if (s_cache->evict_waiters > 0) {
+    lock_acquire(&s_cache->evict_lock);
+    cond_broadcast(&s_cache->slot_freed, &s_cache->evict_lock);
+    lock_release(&s_cache->evict_lock);
+  }
+}
+
+/* Writes slot POSITION, which the caller has locked and which
+   must be valid and dirty, back to disk and marks it clean. */
+static void write_back(size_t position) {
+  write_entry_to_disk(position);
+  mark_clean(&s_cache->sector_list[position]);
 }
 
 /* Iterates through the sector cache and flushes 
@@ -121,213 +252,475 @@ void write_entry_to_disk(int position) {
    does not evict the flushed sectors from the cache. */
 void cache_flush(void) {
   lock_acquire(&(s_cache->global_lock));
-  for (int i = 0; i < 64; i++) {
-    lock_acquire(s_cache->sector_locks[i]);
-    if (is_valid(i) && is_dirty(i)) {
-      write_entry_to_disk(i);
-      toggle_dirty(i);
-    }
-    lock_release(s_cache->sector_locks[i]);
+  for (size_t i = 0; i < s_cache->size; i++) {
+    sector_node* entry = &s_cache->sector_list[i];
+    lock_acquire(&entry->lock);
+    if (entry->valid && entry->dirty)
+      write_back(i);
+    cache_release(entry);
   }
   lock_release(&(s_cache->global_lock));
 }
 
 /* Performs a cache lookup for the provided sector.
-   returns the */
+   Returns the slot index holding SECTOR, or -1 if it is not
+   cached.  The slot is not locked, so callers must recheck its
+   sector under the slot lock. */
 int cache_lookup(block_sector_t sector) {
-  for (int i = 0; i < 64; i++) {
-    sector_node* entry = s_cache->sector_list[i];
-    if (is_valid(i) && entry->sector == sector) {
-      return i;
+  sector_node key;
+  struct hash_elem* e;
+
+  key.sector = sector;
+  lock_acquire(&s_cache->index_lock);
+  int compares = s_cache->compares;
+  e = hash_find(&s_cache->index, &key.hash_elem);
+  s_cache->lookups++;
+  s_cache->lookup_compares += s_cache->compares - compares;
+  lock_release(&s_cache->index_lock);
+  if (e == NULL)
+    return -1;
+  return hash_entry(e, sector_node, hash_elem) - s_cache->sector_list;
+}
+
+/* Returns true if some slot is not locked by any thread. */
+static bool cache_has_free_slot(void) {
+  for (size_t i = 0; i < s_cache->size; i++)
+    if (s_cache->sector_list[i].lock.holder == NULL)
+      return true;
+  return false;
+}
+
+/* Picks a slot to reuse by sweeping the clock hand, giving
+   recently accessed slots a second chance.  Slots that are
+   locked, by another thread or by the caller, are in use and
+   are skipped.  Writes the victim back if it is dirty and drops
+   it from the index.  Returns the victim locked and invalid.
+
+   If two full sweeps find every slot in use, releases the
+   global lock, blocks until some slot lock is released, and
+   returns a null pointer with the global lock held again.  The
+   caller must then start over, since another thread may have
+   cached the sector it wanted meanwhile.  The global lock must
+   be held. */
+static sector_node* cache_evict(void) {
+  ASSERT(lock_held_by_current_thread(&s_cache->global_lock));
+
+  for (size_t n = 0; n < 2 * s_cache->size; n++) {
+    size_t i = s_cache->clock_hand;
+    sector_node* entry = &s_cache->sector_list[i];
+    s_cache->clock_hand = (i + 1) % s_cache->size;
+    if (lock_held_by_current_thread(&entry->lock) || !lock_try_acquire(&entry->lock))
+      continue;
+    if (entry->valid && entry->accessed) {
+      entry->accessed = false;
+      lock_release(&entry->lock);
+      continue;
     }
+    if (entry->valid) {
+      if (entry->dirty)
+        write_back(i);
+      if (entry->prefetched)
+        s_cache->ra_misses++;
+      lock_acquire(&s_cache->index_lock);
+      hash_delete(&s_cache->index, &entry->hash_elem);
+      lock_release(&s_cache->index_lock);
+    }
+    entry->valid = entry->dirty = entry->prefetched = false;
+    return entry;
   }
-  return -1;
+
+  /* Every slot is in use.  A slot released after the sweep but
+     before evict_waiters went up sent no signal, so look for one
+     before sleeping. */
+  lock_acquire(&s_cache->evict_lock);
+  s_cache->evict_waiters++;
+  lock_release(&s_cache->global_lock);
+  if (!cache_has_free_slot())
+    cond_wait(&s_cache->slot_freed, &s_cache->evict_lock);
+  s_cache->evict_waiters--;
+  lock_release(&s_cache->evict_lock);
+  lock_acquire(&s_cache->global_lock);
+  return NULL;
 }
 
-/* Reads data at sector into buf. Stores the result 
-   in the cache. If the cache is full, evicts an entry by LRU,
-   flushing the entry if it is dirty. */
-void cache_read(block_sector_t sector, void* buf) {
-  /* Perform cache lookup and access entry if one exists */
-  int position = cache_lookup(sector);
-  while (position != -1) {
-    lock_acquire(s_cache->sector_locks[position]);
-    sector_node* entry = s_cache->sector_list[position];
-    if (is_valid(position) && entry->sector == sector) {
-      memcpy(buf, entry->buf, BLOCK_SECTOR_SIZE);
-      s_cache->hits++;
-      lock_release(s_cache->sector_locks[position]);
-      return;
-    } else
-      lock_release(s_cache->sector_locks[position]);
-    position = cache_lookup(sector);
-  }
+/* Claims a slot for SECTOR and enters it in the index, unless
+   SECTOR is already cached.  Returns the slot locked, without
+   its contents loaded, or a null pointer if SECTOR is already
+   cached.  Other threads that find SECTOR after this returns
+   wait on the slot lock until the caller fills the slot in.
+   The global lock must be held. */
+static sector_node* cache_claim(block_sector_t sector) {
+  ASSERT(lock_held_by_current_thread(&s_cache->global_lock));
+
+  sector_node* entry;
+  do {
+    if (cache_lookup(sector) != -1)
+      return NULL;
+    entry = cache_evict();
+  } while (entry == NULL);
+  entry->sector = sector;
+  entry->valid = entry->accessed = true;
+  lock_acquire(&s_cache->index_lock);
+  hash_insert(&s_cache->index, &entry->hash_elem);
+  lock_release(&s_cache->index_lock);
+  return entry;
+}
+
+/* Like cache_claim(), but takes the global lock itself. */
+static sector_node* cache_insert(block_sector_t sector) {
   lock_acquire(&s_cache->global_lock);
-  /* Look for empty space for cache entry */
-  for (int i = 0; i < 64; i++) {
-    if (!is_valid(i)) {
-      lock_acquire(s_cache->sector_locks[i]);
-      if (!is_valid(i)) {
-        sector_node* entry = s_cache->sector_list[i];
-        entry->sector = sector;
-        block_read(fs_device, sector, entry->buf);
-        memcpy(buf, entry->buf, BLOCK_SECTOR_SIZE);
-        s_cache->misses++;
-        toggle_valid(i);
-        if (is_dirty(i))
-          toggle_dirty(i);
-        if (is_evictable(i))
-          toggle_evictable(i);
-        lock_release(s_cache->sector_locks[i]);
-        lock_release(&s_cache->global_lock);
-        return;
-      } else
-        lock_release(s_cache->sector_locks[i]);
-    }
-  }
-  /* Evict something if no empty space*/
-  int last_evict = s_cache->last_evict;
-  int i = (last_evict + 1) % 64;
+  sector_node* entry = cache_claim(sector);
+  lock_release(&s_cache->global_lock);
+  return entry;
+}
+
+/* Returns the slot holding SECTOR with its lock held, bringing
+   SECTOR into the cache if needed.  If LOAD is false the caller
+   is about to overwrite the whole sector, so a miss skips the
+   disk read. */
+static sector_node* cache_acquire(block_sector_t sector, bool load) {
   for (;;) {
-    lock_acquire(s_cache->sector_locks[i]);
-    if (is_evictable(i)) {
-      if (is_dirty(i)) {
-        write_entry_to_disk(i);
-        toggle_dirty(i);
+    /* Perform cache lookup and access entry if one exists */
+    int position = cache_lookup(sector);
+    if (position != -1) {
+      sector_node* entry = &s_cache->sector_list[position];
+      lock_acquire(&entry->lock);
+      if (entry->valid && entry->sector == sector) {
+        entry->accessed = true;
+        if (entry->prefetched) {
+          entry->prefetched = false;
+          s_cache->ra_hits++;
+        }
+        s_cache->hits++;
+        return entry;
       }
-      toggle_evictable(i);
-      s_cache->last_evict = i;
-      sector_node* entry = s_cache->sector_list[i];
-      entry->sector = sector;
+      cache_release(entry);
+      continue;
+    }
+
+    /* Another thread may have brought SECTOR in while we waited. */
+    sector_node* entry = cache_insert(sector);
+    if (entry == NULL)
+      continue;
+    if (load)
       block_read(fs_device, sector, entry->buf);
-      memcpy(buf, entry->buf, BLOCK_SECTOR_SIZE);
-      s_cache->misses++;
-      lock_release(s_cache->sector_locks[i]);
-      lock_release(&s_cache->global_lock);
-      return;
-    } else
-      toggle_evictable(i);
-    lock_release(s_cache->sector_locks[i]);
-    i = (i + 1) % 64;
+    s_cache->misses++;
+    return entry;
   }
 }
 
-/* Writes data from buf into a new/existing cache entry for sector. 
-   If the cache is full, evicts an entry by LRU, flushing 
-   the entry if it is dirty. */
-void cache_write(block_sector_t sector, void* buf) {
-  /* Perform cache lookup and access entry if one exists */
-  int position = cache_lookup(sector);
-  while (position != -1) {
-    lock_acquire(s_cache->sector_locks[position]);
-    sector_node* entry = s_cache->sector_list[position];
-    if (is_valid(position) && entry->sector == sector) {
-      memcpy(entry->buf, buf, BLOCK_SECTOR_SIZE);
-      if (!is_dirty(position))
-        toggle_dirty(position);
-      if (is_evictable(position))
-        toggle_evictable(position);
-      s_cache->hits++;
-      lock_release(s_cache->sector_locks[position]);
-      return;
-    } else {
-      lock_release(s_cache->sector_locks[position]);
-    }
-    position = cache_lookup(sector);
+/* Queues SECTOR to be prefetched into the cache by the
+   read-ahead thread.  The request is dropped if read-ahead is
+   disabled or the queue is full; read-ahead is only a hint. */
+void cache_read_ahead(block_sector_t sector) {
+  if (s_cache->ra_window == 0)
+    return;
+  lock_acquire(&s_cache->ra_lock);
+  if (s_cache->ra_count < READ_AHEAD_QUEUE_SIZE) {
+    s_cache->ra_queue[(s_cache->ra_head + s_cache->ra_count) % READ_AHEAD_QUEUE_SIZE] = sector;
+    s_cache->ra_count++;
+    cond_signal(&s_cache->ra_ready, &s_cache->ra_lock);
   }
-  lock_acquire(&s_cache->global_lock);
-  /* Look for empty space for cache entry */
-  for (int i = 0; i < 64; i++) {
-    if (!is_valid(i)) {
-      lock_acquire(s_cache->sector_locks[i]);
-      if (!is_valid(i)) {
-        sector_node* entry = s_cache->sector_list[i];
-        entry->sector = sector;
-        memcpy(entry->buf, buf, BLOCK_SECTOR_SIZE);
-        s_cache->misses++;
-        toggle_valid(i);
-        if (!is_dirty(i))
-          toggle_dirty(i);
-        if (is_evictable(i))
-          toggle_evictable(i);
-        lock_release(s_cache->sector_locks[i]);
-        lock_release(&s_cache->global_lock);
-        return;
+  lock_release(&s_cache->ra_lock);
+}
+
+/* Returns how many sectors to prefetch ahead of a sequential
+   reader, 0 if read-ahead is disabled. */
+size_t cache_read_ahead_window(void) { return s_cache->ra_window; }
+
+/* Loads the CNT adjacent sectors starting at SECTOR into SLOTS,
+   which the caller has claimed with cache_insert(), using one
+   disk command, and then releases them. */
+static void read_ahead_run(block_sector_t sector, sector_node** slots, size_t cnt) {
+  if (cnt == 0)
+    return;
+  if (cnt == 1)
+    block_read(fs_device, sector, slots[0]->buf);
+  else {
+    block_read_multiple(fs_device, sector, cnt, read_ahead_bounce);
+    for (size_t i = 0; i < cnt; i++)
+      memcpy(slots[i]->buf, read_ahead_bounce + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+  }
+  for (size_t i = 0; i < cnt; i++) {
+    slots[i]->prefetched = true;
+    cache_release(slots[i]);
+  }
+}
+
+/* Read-ahead thread.  Pulls runs of adjacent sectors off the
+   read-ahead queue and loads the ones that are not already
+   cached, so that the reader that queued them finds them
+   resident.  Prefetches do not count as cache hits or misses.
+
+   The slots for a whole run are claimed in one hold of the
+   global lock.  Taking the global lock again while holding slot
+   locks would deadlock against cache_flush() and reset_cache(),
+   which hold the global lock while they wait for each slot. */
+static void read_ahead_daemon(void* aux UNUSED) {
+  sector_node* claimed[CACHE_MAX_RUN];
+  sector_node* slots[CACHE_MAX_RUN];
+  size_t max_run = CACHE_MAX_RUN;
+
+  /* Leave most of a small cache free for eviction while a run's
+     slots are held. */
+  if (max_run > s_cache->size / 4)
+    max_run = s_cache->size / 4 > 0 ? s_cache->size / 4 : 1;
+
+  for (;;) {
+    block_sector_t first;
+    size_t run = 0;
+
+    lock_acquire(&s_cache->ra_lock);
+    while (s_cache->ra_count == 0)
+      cond_wait(&s_cache->ra_ready, &s_cache->ra_lock);
+    first = s_cache->ra_queue[s_cache->ra_head];
+    do {
+      s_cache->ra_head = (s_cache->ra_head + 1) % READ_AHEAD_QUEUE_SIZE;
+      s_cache->ra_count--;
+      run++;
+    } while (run < max_run && s_cache->ra_count > 0 &&
+             s_cache->ra_queue[s_cache->ra_head] == first + run);
+    lock_release(&s_cache->ra_lock);
+
+    /* Claim slots for the uncached sectors, then read each
+       stretch of them that is not interrupted by a cached
+       sector. */
+    lock_acquire(&s_cache->global_lock);
+    for (size_t i = 0; i < run; i++)
+      claimed[i] = cache_claim(first + i);
+    lock_release(&s_cache->global_lock);
+
+    block_sector_t start = first;
+    size_t cnt = 0;
+    for (size_t i = 0; i < run; i++) {
+      sector_node* entry = claimed[i];
+      if (entry == NULL) {
+        read_ahead_run(start, slots, cnt);
+        start = first + i + 1;
+        cnt = 0;
       } else
-        lock_release(s_cache->sector_locks[i]);
+        slots[cnt++] = entry;
     }
+    read_ahead_run(start, slots, cnt);
   }
-  /* Evict something if no empty space*/
-  int last_evict = s_cache->last_evict;
-  int i = (last_evict + 1) % 64;
-  for (;;) { // not in cache, no open space
-    lock_acquire(s_cache->sector_locks[i]);
-    if (is_evictable(i)) {
-      if (is_dirty(i))
-        write_entry_to_disk(i);
-      else
-        toggle_dirty(i);
-      toggle_evictable(i);
-      s_cache->last_evict = i;
-      sector_node* entry = s_cache->sector_list[i];
-      entry->sector = sector;
-      memcpy(entry->buf, buf, BLOCK_SECTOR_SIZE);
-      s_cache->misses++;
-      lock_release(s_cache->sector_locks[i]);
-      lock_release(&s_cache->global_lock);
-      return;
-    } else
-      toggle_evictable(i);
-    lock_release(s_cache->sector_locks[i]);
-    i = (i + 1) % 64;
-  }
 }
 
-/* Function for bitmap checks. */
-bool is_true(uint64_t bitmap, int i);
-bool is_true(uint64_t bitmap, int i) { return bitmap & (((int64_t)1) << i); }
+/* Orders flush items from least to most recently dirtied. */
+static int flush_item_older(const void* a_, const void* b_) {
+  const struct flush_item* a = a_;
+  const struct flush_item* b = b_;
+  return a->dirty_since < b->dirty_since ? -1 : a->dirty_since > b->dirty_since;
+}
+
+/* Orders flush items by ascending sector number. */
+static int flush_item_lower(const void* a_, const void* b_) {
+  const struct flush_item* a = a_;
+  const struct flush_item* b = b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Picks the dirty slots that are due under the write-behind
+   policy and writes them back in ascending sector order, so
+   that runs of adjacent sectors go to disk in a single sweep.
+   Slots that are in use are left for the next pass. */
+static void write_behind(void) {
+  int64_t now = timer_ticks();
+  size_t high = s_cache->size * DIRTY_HIGH_PCT / 100;
+  size_t low = s_cache->size * DIRTY_LOW_PCT / 100;
+  size_t dirty_cnt = s_cache->dirty_cnt;
+  bool over = dirty_cnt > high;
+  size_t cnt = 0;
+
+  /* Snapshot candidates without locking; each one is rechecked
+     under its slot lock before it is written.  Over the
+     high-water mark, slots whose clock bit is clear are next in
+     line for eviction, so they are candidates too.  Slots still
+     being accessed, such as a growing file's inode, would only
+     be dirtied again and wait until they age. */
+  for (size_t i = 0; i < s_cache->size; i++) {
+    sector_node* entry = &s_cache->sector_list[i];
+    if (entry->valid && entry->dirty &&
+        (now - entry->dirty_since >= WRITE_BEHIND_AGE || (over && !entry->accessed))) {
+      flush_batch[cnt].slot = i;
+      flush_batch[cnt].sector = entry->sector;
+      flush_batch[cnt].dirty_since = entry->dirty_since;
+      cnt++;
+    }
+  }
+
+  /* Over the high-water mark, keep every aged slot plus enough
+     of the oldest others to get down to the low-water mark. */
+  if (over) {
+    size_t aged = 0;
+    qsort(flush_batch, cnt, sizeof *flush_batch, flush_item_older);
+    while (aged < cnt && now - flush_batch[aged].dirty_since >= WRITE_BEHIND_AGE)
+      aged++;
+    if (dirty_cnt - low > aged)
+      aged = dirty_cnt - low;
+    if (aged < cnt)
+      cnt = aged;
+  }
 
-/* Checks the s_cache valid bitmap and returns whether the bit is true or false. */
-bool is_valid(int i) { return is_true(s_cache->valid_bitmap, i); }
+  qsort(flush_batch, cnt, sizeof *flush_batch, flush_item_lower);
+  for (size_t i = 0; i < cnt;) {
+    size_t run = 0;
+
+    /* Lock the longest run of adjacent sectors starting at I
+       that are still cached, dirty and not in use. */
+    while (i + run < cnt && run < CACHE_MAX_RUN &&
+           flush_batch[i + run].sector == flush_batch[i].sector + run) {
+      sector_node* entry = &s_cache->sector_list[flush_batch[i + run].slot];
+      if (!lock_try_acquire(&entry->lock))
+        break;
+      if (!entry->valid || !entry->dirty || entry->sector != flush_batch[i + run].sector) {
+        cache_release(entry);
+        break;
+      }
+      run++;
+    }
+    if (run == 0) {
+      i++;
+      continue;
+    }
 
-/* Checks the s_cache dirty bitmap and returns whether the bit is true or false. */
-bool is_dirty(int i) { return is_true(s_cache->dirty_bitmap, i); }
+    if (run == 1)
+      write_entry_to_disk(flush_batch[i].slot);
+    else {
+      for (size_t j = 0; j < run; j++)
+        memcpy(flush_bounce + j * BLOCK_SECTOR_SIZE,
+               s_cache->sector_list[flush_batch[i + j].slot].buf, BLOCK_SECTOR_SIZE);
+      block_write_multiple(fs_device, flush_batch[i].sector, run, flush_bounce);
+    }
+    for (size_t j = 0; j < run; j++) {
+      sector_node* entry = &s_cache->sector_list[flush_batch[i + j].slot];
+      mark_clean(entry);
+      cache_release(entry);
+    }
+    i += run;
+  }
+}
 
-/* Checks the s_cache clock bitmap and returns whether the bit is true or false. */
-bool is_evictable(int i) { return is_true(s_cache->clock_bitmap, i); }
+/* Wakes the flusher thread if it is waiting for something to
+   write back.  Called after a cache slot or the free map becomes
+   dirty. */
+void cache_wake_flusher(void) {
+  if (s_cache->flusher_idle) {
+    lock_acquire(&s_cache->flush_lock);
+    cond_signal(&s_cache->flush_ready, &s_cache->flush_lock);
+    lock_release(&s_cache->flush_lock);
+  }
+}
 
-/* Function for bitmap sets. */
-void toggle_bit(uint64_t* bitmap, int i);
-void toggle_bit(uint64_t* bitmap, int i) { *bitmap = *bitmap ^ (((int64_t)1) << i); }
+/* Flusher thread.  While the cache or the free map is dirty,
+   wakes every WRITE_BEHIND_PERIOD ticks, copies the in-memory
+   free map into the cache if it has changed, and writes back
+   whatever the write-behind policy says is due, so that
+   evictions seldom have to write a dirty sector back on the
+   caller's path.  When nothing is dirty it sleeps until
+   cache_wake_flusher(), so that it keeps no timer pending and
+   an idle system can stop ticking. */
+static void flusher_daemon(void* aux UNUSED) {
+  for (;;) {
+    /* FLUSHER_IDLE goes up before the check, so that a slot
+       dirtied after the check sees it and signals. */
+    lock_acquire(&s_cache->flush_lock);
+    s_cache->flusher_idle = true;
+    while (s_cache->dirty_cnt == 0 && !free_map_is_dirty())
+      cond_wait(&s_cache->flush_ready, &s_cache->flush_lock);
+    s_cache->flusher_idle = false;
+    lock_release(&s_cache->flush_lock);
+
+    timer_sleep(WRITE_BEHIND_PERIOD);
+    free_map_flush();
+    if (s_cache->dirty_cnt > 0)
+      write_behind();
+  }
+}
 
-/* Toggles a sector's valid bit. */
-void toggle_valid(int i) { toggle_bit(&(s_cache->valid_bitmap), i); }
+/* Reads data at sector into buf. Stores the result 
+   in the cache. If the cache is full, evicts an entry by clock,
+   flushing the entry if it is dirty. */
+void cache_read(block_sector_t sector, void* buf) {
+  sector_node* entry = cache_acquire(sector, true);
+  memcpy(buf, entry->buf, BLOCK_SECTOR_SIZE);
+  cache_release(entry);
+}
 
-/* Toggles a sector's dirty bit. */
-void toggle_dirty(int i) { toggle_bit(&(s_cache->dirty_bitmap), i); }
+/* Writes data from buf into a new/existing cache entry for sector. 
+   If the cache is full, evicts an entry by clock, flushing 
+   the entry if it is dirty. */
+void cache_write(block_sector_t sector, const void* buf) {
+  sector_node* entry = cache_acquire(sector, false);
+  memcpy(entry->buf, buf, BLOCK_SECTOR_SIZE);
+  mark_dirty(entry);
+  cache_release(entry);
+}
 
-/* Toggles a sector's clock bit. */
-void toggle_evictable(int i) { toggle_bit(&(s_cache->clock_bitmap), i); }
+/* Pins SECTOR in the cache and returns a pointer to its cached
+   BLOCK_SECTOR_SIZE bytes, which the caller may read or modify in
+   place until it calls cache_unpin().  If LOAD is false the
+   caller is about to overwrite the whole sector, so a miss skips
+   the disk read and the buffer contents are undefined.
+
+   The slot stays locked while pinned, so callers must not pin
+   more than one sector or call any other cache function until
+   they unpin it. */
+void* cache_pin(block_sector_t sector, bool load) { return cache_acquire(sector, load)->buf; }
+
+/* Unpins the cached sector BUF returned by cache_pin(), marking
+   it dirty if the caller modified it. */
+void cache_unpin(void* buf, bool dirty) {
+  size_t position = ((char*)buf - s_cache->buffers) / BLOCK_SECTOR_SIZE;
+  sector_node* entry = &s_cache->sector_list[position];
+
+  ASSERT(position < s_cache->size);
+  ASSERT(entry->buf == buf);
+  if (dirty)
+    mark_dirty(entry);
+  cache_release(entry);
+}
 
-/* Gets the current hitrate of the cache. */
+/* Gets the current hitrate of the cache, as a percentage.  Uses
+   integer math, since SYS_CACHE_HR runs with the user program's
+   FPU registers still loaded. */
 int get_hitrate() {
   if (s_cache->hits + s_cache->misses == 0)
     return 0;
-  return (int)(((double)s_cache->hits / (s_cache->hits + s_cache->misses)) * 100);
+  return s_cache->hits * 100 / (s_cache->hits + s_cache->misses);
 }
 
+/* Gets the number of prefetched sectors that were used. */
+int get_read_ahead_hits(void) { return s_cache->ra_hits; }
+
+/* Gets the number of prefetched sectors evicted before use. */
+int get_read_ahead_misses(void) { return s_cache->ra_misses; }
+
+/* Gets the number of cache lookups. */
+int get_cache_lookups(void) { return s_cache->lookups; }
+
+/* Gets the number of sector comparisons cache lookups made,
+   which stays near two per lookup as long as the index keeps
+   its buckets short. */
+int get_cache_lookup_compares(void) { return s_cache->lookup_compares; }
+
 /* Flushes the cache, then marks everything as invalid. */
 void reset_cache() {
   lock_acquire(&s_cache->global_lock);
-  for (int i = 0; i < 64; i++)
-    lock_acquire(s_cache->sector_locks[i]);
-  for (int i = 0; i < 64; i++)
-    if (is_valid(i) && is_dirty(i))
-      write_entry_to_disk(i);
-  s_cache->valid_bitmap = 0;
-  for (int i = 0; i < 64; i++)
-    lock_release(s_cache->sector_locks[i]);
+  for (size_t i = 0; i < s_cache->size; i++) {
+    sector_node* entry = &s_cache->sector_list[i];
+    lock_acquire(&entry->lock);
+    if (entry->valid && entry->dirty)
+      write_back(i);
+    entry->valid = entry->dirty = entry->accessed = entry->prefetched = false;
+    cache_release(entry);
+  }
+  lock_acquire(&s_cache->index_lock);
+  hash_clear(&s_cache->index, NULL);
+  lock_release(&s_cache->index_lock);
+  s_cache->clock_hand = 0;
   s_cache->hits = s_cache->misses = 0;
+  s_cache->ra_hits = s_cache->ra_misses = 0;
+  s_cache->lookups = s_cache->lookup_compares = 0;
   lock_release(&s_cache->global_lock);
 }
 
@@ -343,10 +736,10 @@ static void do_format(void) {
   free_map_create();
   if (!dir_create(ROOT_DIR_SECTOR, 16))
     PANIC("root directory creation failed");
-  free_map_close();
   struct dir* root = dir_open_root();
   if (!dir_add(root, ".", ROOT_DIR_SECTOR) || !dir_add(root, "..", ROOT_DIR_SECTOR))
     PANIC("root directory . & .. failed");
   dir_close(root);
+  free_map_close();
   printf("done.\n");
 }
\ No newline at end of file
@@ -4,54 +4,110 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
+#include "devices/timer.h"
 #include "threads/synch.h"
+#include <hash.h>
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0 /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1 /* Root directory file inode sector. */
 
+/* Number of sectors the buffer cache holds unless overridden
+   by the "-cache=COUNT" kernel command-line option. */
+#define CACHE_DEFAULT_SECTORS 64
+
+/* Fewest sectors the buffer cache may hold.  Pinned slots, a
+   read-ahead run and a write-behind run can all be held at once,
+   and eviction needs a slot beyond those. */
+#define CACHE_MIN_SECTORS 16
+
+/* Number of sectors to prefetch ahead of a sequential reader
+   unless overridden by the "-readahead=COUNT" option. */
+#define READ_AHEAD_DEFAULT_SECTORS 8
+
+/* Capacity of the queue of pending read-ahead requests. */
+#define READ_AHEAD_QUEUE_SIZE 64
+
+/* Write-behind policy.  While anything is dirty, every
+   WRITE_BEHIND_PERIOD timer ticks the flusher thread writes back
+   sectors that have been dirty for at least WRITE_BEHIND_AGE
+   ticks.  If more than DIRTY_HIGH_PCT percent of the cache is
+   dirty, it also writes back the oldest dirty sectors until no
+   more than DIRTY_LOW_PCT percent are. */
+#define WRITE_BEHIND_PERIOD (TIMER_FREQ / 10)
+#define WRITE_BEHIND_AGE (3 * TIMER_FREQ)
+#define DIRTY_HIGH_PCT 50
+#define DIRTY_LOW_PCT 25
+
 typedef struct {
-  block_sector_t sector;       // id
-  char buf[BLOCK_SECTOR_SIZE]; // buffer from disk
+  block_sector_t sector;      // id
+  bool valid;                 // slot holds SECTOR
+  bool dirty;                 // slot must be written back before reuse
+  bool accessed;              // clock bit, cleared as the eviction hand passes
+  bool prefetched;            // loaded by read-ahead and not yet used
+  int64_t dirty_since;        // timer tick at which the slot became dirty
+  struct lock lock;           // slot lock for atomic read/write (race free lookup)
+  struct hash_elem hash_elem; // element in sector_cache index
+  char* buf;                  // buffer from disk
 } sector_node;
 
 struct sector_cache {
   int hits;
   int misses;
-  struct lock global_lock;    // global lock for evictions and lookups
-  sector_node** sector_list;  // list of sector nodes that hold inode buffers
-  struct lock** sector_locks; // list of sector locks for atomic read/write (race free lookup)
-  uint64_t dirty_bitmap;
-  uint64_t valid_bitmap;
-  uint64_t clock_bitmap;
-  int last_evict;
+  struct lock global_lock;   // global lock for evictions
+  struct lock index_lock;    // protects index
+  struct hash index;         // valid slots, keyed by sector number
+  sector_node* sector_list;  // array of SIZE cache slots
+  char* buffers;             // SIZE sector buffers, slot I's at I * BLOCK_SECTOR_SIZE
+  size_t size;               // number of slots, fixed at boot
+  size_t clock_hand;         // next slot the eviction clock examines
+  size_t dirty_cnt;          // number of dirty slots
+  struct lock flush_lock;    // protects flusher_idle
+  struct condition flush_ready; // signaled when there is something to write back
+  bool flusher_idle;         // flusher is waiting on flush_ready
+  struct lock evict_lock;    // protects evict_waiters
+  struct condition slot_freed; // signaled when a slot lock is released
+  int evict_waiters;         // threads waiting in cache_evict() for a slot
+  int ra_hits;               // prefetched sectors that were later used
+  int ra_misses;             // prefetched sectors evicted unused
+  int compares;              // sector comparisons made in the index, under index_lock
+  int lookups;               // cache_lookup() calls
+  int lookup_compares;       // sector comparisons made by those calls
+  size_t ra_window;          // sectors to prefetch ahead of a sequential reader
+  struct lock ra_lock;       // protects the read-ahead queue
+  struct condition ra_ready; // signaled when the queue becomes non-empty
+  block_sector_t ra_queue[READ_AHEAD_QUEUE_SIZE]; // sectors waiting to be prefetched
+  size_t ra_head;            // index of the oldest queued sector
+  size_t ra_count;           // number of queued sectors
 };
 
 /* Block device that contains the file system. */
 extern struct block* fs_device;
 
-void filesys_init(bool format);
+void filesys_init(bool format, size_t cache_sectors, size_t read_ahead_sectors);
 void filesys_done(void);
 bool filesys_create(const char* name, off_t initial_size);
 struct file* filesys_open(const char* name);
 // bool filesys_remove(const char* name, struct dir*);
 
 // sector cache functions
+void cache_init(size_t sectors, size_t read_ahead);
 void cache_flush(void);
 int cache_lookup(block_sector_t sector);
 void cache_read(block_sector_t sector, void* buf);
-void cache_write(block_sector_t sector, void* buf);
+void cache_write(block_sector_t sector, const void* buf);
+void* cache_pin(block_sector_t sector, bool load);
+void cache_unpin(void* buf, bool dirty);
+void cache_read_ahead(block_sector_t sector);
+void cache_wake_flusher(void);
+size_t cache_read_ahead_window(void);
 void write_entry_to_disk(int position);
 
-bool is_valid(int i);
-bool is_dirty(int i);
-bool is_evictable(int i);
-
-void toggle_valid(int i);
-void toggle_dirty(int i);
-void toggle_evictable(int i);
-
 int get_hitrate(void);
+int get_read_ahead_hits(void);
+int get_read_ahead_misses(void);
+int get_cache_lookups(void);
+int get_cache_lookup_compares(void);
 void reset_cache(void);
 
 int get_fs_reads(void);
@@ -4,9 +4,13 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file* free_map_file; /* Free map file. */
 static struct bitmap* free_map;    /* Free map, one bit per sector. */
+static struct lock free_map_lock;  /* Protects the variables below and FREE_MAP. */
+static size_t next_fit;            /* Where the next allocation search starts. */
+static bool free_map_dirty;        /* Does FREE_MAP differ from the free map file? */
 
 /* Initializes the free map. */
 void free_map_init(void) {
@@ -15,31 +19,73 @@ void free_map_init(void) {
     PANIC("bitmap creation failed--file system device is too large");
   bitmap_mark(free_map, FREE_MAP_SECTOR);
   bitmap_mark(free_map, ROOT_DIR_SECTOR);
+  lock_init(&free_map_lock);
+  next_fit = 0;
+  free_map_dirty = false;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
+   The search starts where the previous allocation ended and
+   wraps around, so that sectors allocated one after another are
+   laid out one after another on disk.  The free map file is
+   only brought up to date by free_map_flush().
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool free_map_allocate(size_t cnt, block_sector_t* sectorp) {
-  block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR && free_map_file != NULL && !bitmap_write(free_map, free_map_file)) {
-    bitmap_set_multiple(free_map, sector, cnt, false);
-    sector = BITMAP_ERROR;
+  block_sector_t sector;
+
+  lock_acquire(&free_map_lock);
+  sector = bitmap_scan_and_flip(free_map, next_fit, cnt, false);
+  if (sector == BITMAP_ERROR && next_fit != 0)
+    sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR) {
+    next_fit = (sector + cnt) % bitmap_size(free_map);
+    free_map_dirty = true;
+    *sectorp = sector;
   }
+  lock_release(&free_map_lock);
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    cache_wake_flusher();
   return sector != BITMAP_ERROR;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void free_map_release(block_sector_t sector, size_t cnt) {
+  lock_acquire(&free_map_lock);
   ASSERT(bitmap_all(free_map, sector, cnt));
   bitmap_set_multiple(free_map, sector, cnt, false);
-  bitmap_write(free_map, free_map_file);
+  free_map_dirty = true;
+  lock_release(&free_map_lock);
+  cache_wake_flusher();
 }
 
+/* Does the work of free_map_flush().  The caller must hold
+   free_map_lock. */
+static void flush_locked(void) {
+  ASSERT(lock_held_by_current_thread(&free_map_lock));
+
+  if (free_map_dirty && free_map_file != NULL) {
+    if (!bitmap_write(free_map, free_map_file))
+      PANIC("can't write free map");
+    free_map_dirty = false;
+  }
+}
+
+/* Writes the free map to the free map file if it has changed
+   since it was last written.  The file goes through the buffer
+   cache like any other, so it reaches disk with the next cache
+   write-back. */
+void free_map_flush(void) {
+  lock_acquire(&free_map_lock);
+  flush_locked();
+  lock_release(&free_map_lock);
+}
+
+/* Returns true if the free map has changed since it was last
+   written to the free map file. */
+bool free_map_is_dirty(void) { return free_map_dirty; }
+
 /* Opens the free map file and reads it from disk. */
 void free_map_open(void) {
   free_map_file = file_open(inode_open(FREE_MAP_SECTOR));
@@ -49,8 +95,17 @@ void free_map_open(void) {
     PANIC("can't read free map");
 }
 
-/* Writes the free map to disk and closes the free map file. */
-void free_map_close(void) { file_close(free_map_file); }
+/* Writes the free map to disk and closes the free map file.
+   The flusher thread may call free_map_flush() at any time, so
+   the file is closed and forgotten under the same hold of
+   free_map_lock as the final flush. */
+void free_map_close(void) {
+  lock_acquire(&free_map_lock);
+  flush_locked();
+  file_close(free_map_file);
+  free_map_file = NULL;
+  lock_release(&free_map_lock);
+}
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
@@ -65,4 +120,5 @@ void free_map_create(void) {
     PANIC("can't open free map");
   if (!bitmap_write(free_map, free_map_file))
     PANIC("can't write free map");
+  free_map_dirty = false;
 }
@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -6,6 +7,7 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -25,7 +27,8 @@ struct inode_disk {
   block_sector_t parent;          /*Start of parent directory address*/
   off_t offset;                   /*Offset from parent directory*/
   off_t length;                   /* File size in bytes. */
-  uint32_t unused[109];           /* Not used. */
+  uint32_t dir_format;            /* Layout of a directory's entries. */
+  uint32_t unused[108];           /* Not used. */
   unsigned magic;
 };
 
@@ -35,68 +38,90 @@ static inline size_t bytes_to_sectors(off_t size) { return DIV_ROUND_UP(size, BL
 
 /* In-memory inode. */
 struct inode {
-  struct list_elem elem; /* Element in inode list. */
-  block_sector_t sector; /* Sector number of disk location. */
-  int open_cnt;          /* Number of openers. */
-  bool removed;          /* True if deleted, false otherwise. */
-  int deny_write_cnt;    /* 0: writes ok, >0: deny writes. */
+  struct hash_elem elem;    /* Element in open_inodes. */
+  block_sector_t sector;    /* Sector number of disk location. */
+  int open_cnt;             /* Number of openers. */
+  bool removed;             /* True if deleted, false otherwise. */
+  int deny_write_cnt;       /* 0: writes ok, >0: deny writes. */
+  struct inode_disk data;   /* Copy of the on-disk inode, valid while open. */
+  block_sector_t* indirect; /* Copy of the indirect block, or NULL if not loaded. */
+  unsigned version;         /* Incremented before and after every write to the data. */
 };
 
+/* Returns INODE's indirect block, reading it into INODE on
+   first use.  Returns NULL if memory allocation fails. */
+static block_sector_t* get_indirect(struct inode* inode) {
+  if (inode->indirect == NULL) {
+    inode->indirect = malloc(BLOCK_SECTOR_SIZE);
+    if (inode->indirect != NULL)
+      cache_read(inode->data.indirect, inode->indirect);
+  }
+  return inode->indirect;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
-static block_sector_t byte_to_sector(const struct inode* inode, off_t pos) {
-  struct inode_disk* disk = calloc(1, sizeof *disk);
-  if (!disk) {
-    return -1;
-  }
-  cache_read(inode->sector, disk);
-  int i;
-  if (disk->magic != INODE_MAGIC)
-    i = -1;
+static block_sector_t byte_to_sector(struct inode* inode, off_t pos) {
   ASSERT(inode != NULL);
-  if (pos > disk->length) {
-    free(disk);
+  struct inode_disk* disk = &inode->data;
+  if (pos > disk->length)
     return -1;
-  }
   off_t sector_num = pos / BLOCK_SECTOR_SIZE;
   if (sector_num < 12) {
-    block_sector_t result = disk->direct[sector_num];
-    free(disk);
-    return result;
+    return disk->direct[sector_num];
   } else if (sector_num >= 12 && sector_num < 140) {
-    block_sector_t buffer[128];
-    cache_read(disk->indirect, buffer);
-    free(disk);
-    return buffer[sector_num - 12];
+    block_sector_t* indirect = get_indirect(inode);
+    if (indirect == NULL)
+      return -1;
+    return indirect[sector_num - 12];
   } else {
-    block_sector_t buffer[128];
-    cache_read(disk->double_indirect, buffer);
-    cache_read(buffer[(sector_num - 140) / 128], buffer);
-    free(disk);
-    return buffer[(sector_num - 140) % 128];
+    block_sector_t* buffer = cache_pin(disk->double_indirect, true);
+    block_sector_t inner = buffer[(sector_num - 140) / 128];
+    cache_unpin(buffer, false);
+    buffer = cache_pin(inner, true);
+    block_sector_t result = buffer[(sector_num - 140) % 128];
+    cache_unpin(buffer, false);
+    return result;
   }
-  free(disk);
-  return -1;
 }
 
+/* A run of adjacent sectors reserved for a file that is growing
+   by several sectors at once, handed out in order. */
+struct reservation {
+  block_sector_t next; /* Next sector to hand out. */
+  size_t left;         /* Sectors not yet handed out. */
+};
+
+/* Allocates a sector into *SECTORP, taking it from R if R has
+   any left.  Returns true if successful. */
+static bool allocate_sector(struct reservation* r, block_sector_t* sectorp) {
+  if (r->left > 0) {
+    *sectorp = r->next++;
+    r->left--;
+    return true;
+  }
+  return free_map_allocate(1, sectorp);
+}
+
+static bool inode_resize(struct inode* inode, off_t size);
+
 /* Resize the inode to the provided size if it can, returns 
-  if the operation succeeds or not. */
-bool inode_resize(struct inode inode, size_t size) {
-  struct inode_disk* disk = calloc(1, sizeof *disk);
+  if the operation succeeds or not.  Updates INODE's in-memory
+  copies and writes them back to the cache.  New sectors come
+  from R first. */
+static bool resize_blocks(struct inode* inode, off_t size, struct reservation* r) {
+  struct inode_disk* disk = &inode->data;
   static char zeros[BLOCK_SECTOR_SIZE];
-  cache_read(inode.sector, disk);
   for (int i = 0; i < 12; i++) {
     if (size < BLOCK_SECTOR_SIZE * i && disk->direct[i] != 0) {
       free_map_release(disk->direct[i], 1);
       disk->direct[i] = 0;
     } else if (size >= BLOCK_SECTOR_SIZE * i && disk->direct[i] == 0) {
-      free_map_allocate(1, &disk->direct[i]);
+      allocate_sector(r, &disk->direct[i]);
       if (disk->direct[i] == 0) {
-        off_t len = disk->length;
-        free(disk);
-        inode_resize(inode, len);
+        inode_resize(inode, disk->length);
         return false;
       }
       cache_write(disk->direct[i], zeros);
@@ -104,19 +129,16 @@ bool inode_resize(struct inode inode, size_t size) {
   }
   if (disk->indirect == 0 && size < 12 * 512) {
     disk->length = size;
-    cache_write(inode.sector, disk);
-    free(disk);
+    cache_write(inode->sector, disk);
     return true;
   }
   block_sector_t buffer[128];
   memset(buffer, 0, 512);
   if (disk->indirect == 0) {
     /* Allocate indirect block. */
-    free_map_allocate(1, &disk->indirect);
+    allocate_sector(r, &disk->indirect);
     if (disk->indirect == 0) {
-      off_t len = disk->length;
-      free(disk);
-      inode_resize(inode, len);
+      inode_resize(inode, disk->length);
       return false;
     }
   } else 
@@ -127,11 +149,9 @@ bool inode_resize(struct inode inode, size_t size) {
       buffer[i] = 0;
     } else if (size >= (12 + i) * BLOCK_SECTOR_SIZE && buffer[i] == 0) {
       /* Grow. */
-      free_map_allocate(1, &buffer[i]);
+      allocate_sector(r, &buffer[i]);
       if (buffer[i] == 0) {
-        off_t len = disk->length;
-        free(disk);
-        inode_resize(inode, len);
+        inode_resize(inode, disk->length);
         return false;
       }
     }
@@ -139,12 +159,16 @@ bool inode_resize(struct inode inode, size_t size) {
   if (size < 12 * BLOCK_SECTOR_SIZE) {
     free_map_release(disk->indirect, 1);
     disk->indirect = 0;
-  } else
+    free(inode->indirect);
+    inode->indirect = NULL;
+  } else {
     cache_write(disk->indirect, buffer);
+    if (inode->indirect != NULL)
+      memcpy(inode->indirect, buffer, BLOCK_SECTOR_SIZE);
+  }
   if (disk->double_indirect == 0 && size < 140 * 512) { //140 is 128 from indirect +12 dir
     disk->length = size;
-    cache_write(inode.sector, disk);
-    free(disk);
+    cache_write(inode->sector, disk);
     return true;
   }
   memset(buffer, 0, 512);
@@ -152,11 +176,9 @@ bool inode_resize(struct inode inode, size_t size) {
   memset(second_buffer, 0, 512);
   if (disk->double_indirect == 0) {
     /* Allocate double indirect block. */
-    free_map_allocate(1, &disk->double_indirect);
+    allocate_sector(r, &disk->double_indirect);
     if (disk->double_indirect == 0) {
-      off_t len = disk->length;
-      free(disk);
-      inode_resize(inode, len);
+      inode_resize(inode, disk->length);
       return false;
     }
   } else
@@ -165,11 +187,9 @@ bool inode_resize(struct inode inode, size_t size) {
   for (int i = 0; i < 128; i++) {
     if (size >= (140 + (i * 128)) * BLOCK_SECTOR_SIZE && buffer[i] == 0) {
       /* Grow. */
-      free_map_allocate(1, &buffer[i]);
+      allocate_sector(r, &buffer[i]);
       if (buffer[i] == 0) {
-        off_t len = disk->length;
-        free(disk);
-        inode_resize(inode, len);
+        inode_resize(inode, disk->length);
         return false;
       }
     }
@@ -182,11 +202,9 @@ bool inode_resize(struct inode inode, size_t size) {
           second_buffer[j] = 0;
         } else if (size >= (140 + j + (i * 128)) * BLOCK_SECTOR_SIZE && second_buffer[j] == 0) {
           /* Grow inner page. */
-          free_map_allocate(1, &second_buffer[j]);
+          allocate_sector(r, &second_buffer[j]);
           if (second_buffer[j] == 0) {
-            off_t len = disk->length;
-            free(disk);
-            inode_resize(inode, len);
+            inode_resize(inode, disk->length);
             return false;
           }
         }
@@ -206,17 +224,60 @@ bool inode_resize(struct inode inode, size_t size) {
   } else
     cache_write(disk->double_indirect, buffer);
   disk->length = size;
-  cache_write(inode.sector, disk);
-  free(disk);
+  cache_write(inode->sector, disk);
   return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Resizes INODE to SIZE bytes, returning true if successful.
+   When the file grows by more than a sector, reserves as long a
+   run of adjacent sectors as the free map has, up to the whole
+   growth, so that the file is laid out contiguously.  A negative
+   SIZE releases every data sector, including the first one
+   inode_create() always allocates. */
+static bool inode_resize(struct inode* inode, off_t size) {
+  struct reservation r = {0, 0};
+  size_t old_cnt = bytes_to_sectors(inode->data.length);
+  size_t new_cnt = size > 0 ? bytes_to_sectors(size) : 0;
+  bool success;
+
+  if (new_cnt > old_cnt + 1) {
+    size_t cnt = new_cnt - old_cnt;
+    while (cnt > 1 && !free_map_allocate(cnt, &r.next))
+      cnt /= 2;
+    if (cnt > 1)
+      r.left = cnt;
+  }
+  success = resize_blocks(inode, size, &r);
+  if (r.left > 0)
+    free_map_release(r.next, r.left);
+  return success;
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Cache of `struct inode's. */
+static struct kmem_cache* inode_cache;
+
+/* Hashes an open inode by its sector. */
+static unsigned inode_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_int(hash_entry(e, struct inode, elem)->sector);
+}
+
+/* Orders open inodes by sector. */
+static bool inode_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct inode, elem)->sector < hash_entry(b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
-void inode_init(void) { list_init(&open_inodes); }
+void inode_init(void) {
+  if (!hash_init(&open_inodes, inode_hash, inode_less, NULL))
+    PANIC("open inode table allocation failed");
+  inode_cache = kmem_cache_create("inode", sizeof(struct inode), NULL);
+  if (inode_cache == NULL)
+    PANIC("inode cache allocation failed");
+}
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
@@ -254,9 +315,11 @@ bool inode_create(block_sector_t sector, off_t length, bool is_dir) {
     }
     free(disk_inode);
     if (sector != 0) {
-      struct inode temp;
-      temp.sector = sector;
-      inode_resize(temp, length);
+      struct inode* inode = inode_open(sector);
+      if (inode != NULL) {
+        inode_resize(inode, length);
+        inode_close(inode);
+      }
     }
   }
   return success;
@@ -266,29 +329,34 @@ bool inode_create(block_sector_t sector, off_t length, bool is_dir) {
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode* inode_open(block_sector_t sector) {
-  struct list_elem* e;
+  struct inode key;
+  struct hash_elem* e;
   struct inode* inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin(&open_inodes); e != list_end(&open_inodes); e = list_next(e)) {
-    inode = list_entry(e, struct inode, elem);
-    if (inode->sector == sector) {
-      inode_reopen(inode);
-      return inode;
-    }
+  key.sector = sector;
+  e = hash_find(&open_inodes, &key.elem);
+  if (e != NULL) {
+    inode = hash_entry(e, struct inode, elem);
+    inode_reopen(inode);
+    return inode;
   }
 
   /* Allocate memory. */
-  inode = malloc(sizeof *inode);
+  inode = kmem_cache_alloc(inode_cache);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front(&open_inodes, &inode->elem);
+  /* Initialize.  SECTOR is the hash key, so it must be set
+     before the inode goes into the table. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->indirect = NULL;
+  inode->version = 0;
+  hash_insert(&open_inodes, &inode->elem);
+  cache_read(inode->sector, &inode->data);
   return inode;
 }
 
@@ -310,24 +378,19 @@ void inode_close(struct inode* inode) {
   if (inode == NULL)
     return;
 
-  struct inode_disk* disk_inode = calloc(1, sizeof *disk_inode);
-  if (disk_inode == NULL)
-    return;
-  cache_read(inode->sector, disk_inode);
-
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0) {
     /* Remove from inode list and release lock. */
-    list_remove(&inode->elem);
+    hash_delete(&open_inodes, &inode->elem);
 
     /* Deallocate blocks if removed. */
     if (inode->removed) {
+      inode_resize(inode, -1);
       free_map_release(inode->sector, 1);
-      free_map_release(disk_inode->direct[0], bytes_to_sectors(disk_inode->length));
     }
-    free(inode);
+    free(inode->indirect);
+    kmem_cache_free(inode_cache, inode);
   }
-  free(disk_inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -339,15 +402,18 @@ void inode_remove(struct inode* inode) {
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   BUFFER is filled with a cache slot locked, so it must not
+   fault. */
 off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset) {
   uint8_t* buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t* bounce = NULL;
 
   while (size > 0) {
     /* Disk sector to read, starting byte offset within sector. */
     block_sector_t sector_idx = byte_to_sector(inode, offset);
+    if (sector_idx + 1 == 0)
+      break;
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
     /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -362,18 +428,12 @@ off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset
 
     if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
       /* Read full sector directly into caller's buffer. */
-      //block_read(fs_device, sector_idx, buffer + bytes_read);
       cache_read(sector_idx, buffer + bytes_read);
     } else {
-      /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-      if (bounce == NULL) {
-        bounce = malloc(BLOCK_SECTOR_SIZE);
-        if (bounce == NULL)
-          break;
-      }
-      cache_read(sector_idx, bounce);
-      memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
+      /* Copy just the wanted bytes straight out of the cache. */
+      uint8_t* cached = cache_pin(sector_idx, true);
+      memcpy(buffer + bytes_read, cached + sector_ofs, chunk_size);
+      cache_unpin(cached, false);
     }
 
     /* Advance. */
@@ -381,32 +441,26 @@ off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset
     offset += chunk_size;
     bytes_read += chunk_size;
   }
-  free(bounce);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs. */
+   less than SIZE if end of file is reached or an error occurs.
+   BUFFER is read with a cache slot locked, so it must not
+   fault. */
 off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t offset) {
-  struct inode_disk* disk_inode = calloc(1, sizeof *disk_inode);
-  if (!disk_inode)
-    return 0;
-  cache_read(inode->sector, disk_inode);
-  if (offset + size > disk_inode->length) {
-    if (!inode_resize(*inode, offset + size)) {
-      free(disk_inode);
+  if (offset + size > inode->data.length) {
+    if (!inode_resize(inode, offset + size))
       return 0;
-    }
   }
-  free(disk_inode);
   const uint8_t* buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t* bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
+  inode->version++;
   while (size > 0) {
     /* Sector to write, starting byte offset within sector. */
     block_sector_t sector_idx = byte_to_sector(inode, offset);
@@ -428,22 +482,16 @@ off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t
       /* Write full sector directly to disk. */
       cache_write(sector_idx, buffer + bytes_written);
     } else {
-      /* We need a bounce buffer. */
-      if (bounce == NULL) {
-        bounce = malloc(BLOCK_SECTOR_SIZE);
-        if (bounce == NULL)
-          break;
-      }
-
-      /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-      if (sector_ofs > 0 || chunk_size < sector_left)
-        cache_read(sector_idx, bounce);
-      else
-        memset(bounce, 0, BLOCK_SECTOR_SIZE);
-      memcpy(bounce + sector_ofs, buffer + bytes_written, chunk_size);
-      cache_write(sector_idx, bounce);
+      /* Modify the cached sector in place.  If the sector
+         contains data before or after the chunk we're writing,
+         then it must be read in first.  Otherwise we start with
+         a sector of all zeros. */
+      bool partial = sector_ofs > 0 || chunk_size < sector_left;
+      uint8_t* cached = cache_pin(sector_idx, partial);
+      if (!partial)
+        memset(cached, 0, BLOCK_SECTOR_SIZE);
+      memcpy(cached + sector_ofs, buffer + bytes_written, chunk_size);
+      cache_unpin(cached, true);
     }
 
     /* Advance. */
@@ -451,11 +499,55 @@ off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t
     offset += chunk_size;
     bytes_written += chunk_size;
   }
-  free(bounce);
+  inode->version++;
 
   return bytes_written;
 }
 
+/* Pins the cached sector of INODE that holds byte OFFSET and
+   returns a pointer to the start of that sector, or a null
+   pointer if INODE has no data at OFFSET.  The caller may read
+   it in place and must release it with inode_unpin() before
+   making any other file system call. */
+const void* inode_pin_at(struct inode* inode, off_t offset) {
+  block_sector_t sector;
+
+  if (offset >= inode_length(inode))
+    return NULL;
+  sector = byte_to_sector(inode, offset);
+  if (sector + 1 == 0)
+    return NULL;
+  return cache_pin(sector, true);
+}
+
+/* Releases a sector pinned by inode_pin_at(). */
+void inode_unpin(const void* sector) { cache_unpin((void*)sector, false); }
+
+/* Asks the cache to prefetch the sectors of INODE that follow
+   byte offset POS, up to the read-ahead window, the end of the
+   file or the first sector that is not allocated, whichever comes
+   first.  Sectors before ISSUED, which were requested by an
+   earlier call, are not requested again.  Returns the offset
+   just past the last sector requested, to be passed as ISSUED
+   next time. */
+off_t inode_read_ahead(struct inode* inode, off_t pos, off_t issued) {
+  off_t start = pos / BLOCK_SECTOR_SIZE * BLOCK_SECTOR_SIZE;
+  off_t end = start + (off_t)cache_read_ahead_window() * BLOCK_SECTOR_SIZE;
+  off_t length = inode_length(inode);
+
+  if (end > length)
+    end = length;
+  if (start < issued)
+    start = issued;
+  for (; start < end; start += BLOCK_SECTOR_SIZE) {
+    block_sector_t sector = byte_to_sector(inode, start);
+    if (sector + 1 == 0)
+      break;
+    cache_read_ahead(sector);
+  }
+  return start > issued ? start : issued;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void inode_deny_write(struct inode* inode) {
@@ -473,20 +565,25 @@ void inode_allow_write(struct inode* inode) {
 }
 
 /* Returns the length, in bytes, of INODE's data. */
-off_t inode_length(const struct inode* inode) {
-  struct inode_disk* disk_inode = calloc(1, sizeof *disk_inode);
-  cache_read(inode->sector, disk_inode);
-  off_t length = disk_inode->length;
-  free(disk_inode);
-  return length;
-}
+off_t inode_length(const struct inode* inode) { return inode->data.length; }
 
 /* Checks if an inode belongs to a directory. */
-bool inode_is_dir(struct inode* inode) {
-  struct inode_disk disk;
-  cache_read(inode->sector, &disk);
-  return disk.is_dir;
+bool inode_is_dir(struct inode* inode) { return inode->data.is_dir; }
+
+/* Returns the layout of directory INODE's entries, which is 0
+   for directories written before layouts were recorded. */
+uint32_t inode_dir_format(const struct inode* inode) { return inode->data.dir_format; }
+
+/* Records FORMAT as the layout of directory INODE's entries. */
+void inode_set_dir_format(struct inode* inode, uint32_t format) {
+  inode->data.dir_format = format;
+  cache_write(inode->sector, &inode->data);
 }
 
+/* Returns a number that changes whenever INODE's data is
+   written, so that callers can tell whether information they
+   derived from it is still current. */
+unsigned inode_version(const struct inode* inode) { return inode->version; }
+
 bool inode_is_open(struct inode* inode) { return inode->open_cnt > 1; }
 bool inode_is_root(struct inode* inode) { return inode->sector == 1; }
@@ -16,6 +16,9 @@ void inode_close(struct inode*);
 void inode_remove(struct inode*);
 off_t inode_read_at(struct inode*, void*, off_t size, off_t offset);
 off_t inode_write_at(struct inode*, const void*, off_t size, off_t offset);
+const void* inode_pin_at(struct inode*, off_t offset);
+void inode_unpin(const void*);
+off_t inode_read_ahead(struct inode*, off_t pos, off_t issued);
 void inode_deny_write(struct inode*);
 void inode_allow_write(struct inode*);
 off_t inode_length(const struct inode*);
@@ -23,6 +26,9 @@ off_t inode_length(const struct inode*);
 bool inode_is_root(struct inode* inode);
 // directory helper functions
 bool inode_is_dir(struct inode*);
+uint32_t inode_dir_format(const struct inode*);
+void inode_set_dir_format(struct inode*, uint32_t format);
+unsigned inode_version(const struct inode*);
 bool inode_is_open(struct inode* inode);
 
 #endif /* filesys/inode.h */
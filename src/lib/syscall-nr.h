@@ -29,6 +29,8 @@ enum {
   SYS_SEMA_DOWN,    /* Downs a semaphore */
   SYS_SEMA_UP,      /* Ups a semaphore */
   SYS_GET_TID,      /* Gets TID of the current thread */
+  SYS_FUTEX_WAIT,   /* Sleeps while a user word holds a value */
+  SYS_FUTEX_WAKE,   /* Wakes threads sleeping on a user word */
 
   /* Project 3 and optionally project 4. */
   SYS_MMAP,   /* Map a file into memory. */
@@ -41,10 +43,20 @@ enum {
   SYS_ISDIR,   /* Tests if a fd represents a directory. */
   SYS_INUMBER, /* Returns the inode number for a fd. */
 
-  SYS_CACHE_HR,    /* Returns cache hr in percent */
-  SYS_CACHE_RESET, /* Resets the cache */
-  SYS_BLK_RD,      /* Gets block reads */
-  SYS_BLK_WR       /* Gets block writes */
+  SYS_CACHE_HR,       /* Returns cache hr in percent */
+  SYS_CACHE_RESET,    /* Resets the cache */
+  SYS_BLK_RD,         /* Gets block reads */
+  SYS_BLK_WR,         /* Gets block writes */
+  SYS_RA_HITS,        /* Gets prefetched sectors that were used */
+  SYS_RA_MISSES,      /* Gets prefetched sectors evicted unused */
+  SYS_CACHE_LOOKUPS,  /* Gets cache lookups */
+  SYS_CACHE_COMPARES  /* Gets sector comparisons made by cache lookups */
 };
 
+/* Bytes of user address space set aside for each user thread's
+   stack.  The stacks lie in consecutive slots of this size going
+   down from the top of user memory, which is a multiple of it, so
+   a thread can tell its slot from any address on its stack. */
+#define USER_STACK_SLOT_SIZE (1 << 23)
+
 #endif /* lib/syscall-nr.h */
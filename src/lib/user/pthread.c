@@ -12,6 +12,7 @@ tid_t pthread_create(pthread_fun fun, void* arg) {
 
 /* Exits the current thread, and cleans up resources */
 void pthread_exit() {
+  _thread_unregister();
   sys_pthread_exit();
   NOT_REACHED();
 }
@@ -24,6 +25,7 @@ bool pthread_join(tid_t tid) { return sys_pthread_join(tid) != TID_ERROR; }
    OS is required to setup the stack for this function and
    set %eip to point to the start of this function */
 void _pthread_start_stub(pthread_fun fun, void* arg) {
+  _thread_register();
   (*fun)(arg);    // Invoke the thread function
   pthread_exit(); // Call pthread_exit
 }
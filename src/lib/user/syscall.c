@@ -1,6 +1,7 @@
 #include <syscall.h>
 #include "../syscall-nr.h"
 #include <pthread.h>
+#include <stdint.h>
 
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
@@ -129,32 +130,189 @@ void sys_pthread_exit() {
 
 tid_t sys_pthread_join(tid_t tid) { return syscall1(SYS_PT_JOIN, tid); }
 
-bool lock_init(lock_t* lock) { return syscall1(SYS_LOCK_INIT, lock); }
+/* Locks and semaphores.
+
+   The kernel hands out the handle stored in each lock_t and
+   sema_t, checking the address and the initial value.  After that
+   every operation works on a word in the tables below, with an
+   atomic instruction when uncontended, and enters the kernel only
+   to sleep or wake sleepers through futex_wait() and
+   futex_wake().
+
+   A lock remembers its holder so that acquiring it twice or
+   releasing it without holding it can be caught.  Each thread
+   asks the kernel for its tid once, when it starts, and records
+   it in SELVES, which is indexed by stack slot.  Every thread's
+   stack lies in its own USER_STACK_SLOT_SIZE slot below the main
+   thread's, so a thread finds its slot, and so its record, by
+   dividing the distance from the top slot to one of its frame
+   addresses by the slot size. */
+
+/* State of a lock. */
+struct user_lock {
+  int state; /* 0 if free, 1 if held, 2 if held with waiters. */
+  int owner; /* thread_self() of the holder, or 0. */
+  bool valid;
+};
+
+/* State of a semaphore. */
+struct user_sema {
+  int value;   /* Current value. */
+  int waiters; /* Threads about to sleep or asleep on VALUE. */
+  bool valid;
+};
+
+/* Indexed by handle.  A handle is a byte, as lock_t and sema_t. */
+static struct user_lock locks[256];
+static struct user_sema semas[256];
+
+/* Stack slots tracked, which is more than a process can have
+   threads. */
+#define SELVES_MAX 256
+
+/* Top of the highest stack slot, found by the main thread. */
+static uintptr_t stacks_top;
+
+/* Tid of the thread running on each stack slot, or 0. */
+static int selves[SELVES_MAX];
+
+/* Returns the index of the calling thread's stack slot. */
+static unsigned self_slot(void) {
+  return (stacks_top - (uintptr_t)__builtin_frame_address(0)) / USER_STACK_SLOT_SIZE;
+}
+
+/* Records the calling thread's tid for thread_self().  Called by
+   each thread's entry point, the main thread's first. */
+void _thread_register(void) {
+  unsigned slot;
+
+  /* The main thread's stack is in the top slot, which ends at a
+     multiple of USER_STACK_SLOT_SIZE. */
+  if (stacks_top == 0)
+    stacks_top = ((uintptr_t)__builtin_frame_address(0) + USER_STACK_SLOT_SIZE - 1) /
+                 USER_STACK_SLOT_SIZE * USER_STACK_SLOT_SIZE;
+  slot = self_slot();
+  if (slot < SELVES_MAX)
+    selves[slot] = get_tid();
+}
+
+/* Drops the calling thread's record.  Called by a thread about to
+   exit. */
+void _thread_unregister(void) {
+  unsigned slot = self_slot();
+
+  if (slot < SELVES_MAX)
+    selves[slot] = 0;
+}
+
+/* Returns the calling thread's tid without a system call, or 0 if
+   it was never recorded. */
+static int thread_self(void) {
+  unsigned slot = self_slot();
+
+  return slot < SELVES_MAX ? selves[slot] : 0;
+}
+
+bool futex_wait(int* addr, int val) { return syscall2(SYS_FUTEX_WAIT, addr, val) == 0; }
+
+int futex_wake(int* addr, int cnt) { return syscall2(SYS_FUTEX_WAKE, addr, cnt); }
+
+bool lock_init(lock_t* lock) {
+  if (!syscall1(SYS_LOCK_INIT, lock))
+    return false;
+  struct user_lock* l = &locks[(unsigned char)*lock];
+  l->state = 0;
+  l->owner = 0;
+  l->valid = true;
+  return true;
+}
+
+/* Returns the state of LOCK, exiting if it was never
+   initialized. */
+static struct user_lock* lock_lookup(lock_t* lock) {
+  struct user_lock* l = &locks[(unsigned char)*lock];
+  if (!l->valid)
+    exit(1);
+  return l;
+}
 
 void lock_acquire(lock_t* lock) {
-  bool success = syscall1(SYS_LOCK_ACQUIRE, lock);
-  if (!success)
+  struct user_lock* l = lock_lookup(lock);
+  int self = thread_self();
+  int c;
+
+  if (l->owner == self)
     exit(1);
+
+  c = __sync_val_compare_and_swap(&l->state, 0, 1);
+  if (c != 0) {
+    /* Contended: mark the lock as having waiters and sleep until
+       we are the ones to take it. */
+    if (c != 2)
+      c = __sync_lock_test_and_set(&l->state, 2);
+    while (c != 0) {
+      futex_wait(&l->state, 2);
+      c = __sync_lock_test_and_set(&l->state, 2);
+    }
+  }
+  l->owner = self;
 }
 
 void lock_release(lock_t* lock) {
-  bool success = syscall1(SYS_LOCK_RELEASE, lock);
-  if (!success)
+  struct user_lock* l = lock_lookup(lock);
+
+  if (l->owner != thread_self())
     exit(1);
+  l->owner = 0;
+  if (__sync_fetch_and_sub(&l->state, 1) != 1) {
+    l->state = 0;
+    futex_wake(&l->state, 1);
+  }
 }
 
-bool sema_init(sema_t* sema, int val) { return syscall2(SYS_SEMA_INIT, sema, val); }
+bool sema_init(sema_t* sema, int val) {
+  if (!syscall2(SYS_SEMA_INIT, sema, val))
+    return false;
+  struct user_sema* s = &semas[(unsigned char)*sema];
+  s->value = val;
+  s->waiters = 0;
+  s->valid = true;
+  return true;
+}
 
-void sema_down(sema_t* sema) {
-  bool success = syscall1(SYS_SEMA_DOWN, sema);
-  if (!success)
+/* Returns the state of SEMA, exiting if it was never
+   initialized. */
+static struct user_sema* sema_lookup(sema_t* sema) {
+  struct user_sema* s = &semas[(unsigned char)*sema];
+  if (!s->valid)
     exit(1);
+  return s;
+}
+
+void sema_down(sema_t* sema) {
+  struct user_sema* s = sema_lookup(sema);
+
+  for (;;) {
+    int v = s->value;
+    if (v > 0) {
+      if (__sync_bool_compare_and_swap(&s->value, v, v - 1))
+        return;
+    } else {
+      /* An up between our read and the sleep changes VALUE, so the
+         kernel will not let us sleep through it. */
+      __sync_fetch_and_add(&s->waiters, 1);
+      futex_wait(&s->value, 0);
+      __sync_fetch_and_sub(&s->waiters, 1);
+    }
+  }
 }
 
 void sema_up(sema_t* sema) {
-  bool success = syscall1(SYS_SEMA_UP, sema);
-  if (!success)
-    exit(1);
+  struct user_sema* s = sema_lookup(sema);
+
+  __sync_fetch_and_add(&s->value, 1);
+  if (s->waiters > 0)
+    futex_wake(&s->value, 1);
 }
 
 tid_t get_tid(void) { return syscall0(SYS_GET_TID); }
@@ -165,4 +323,12 @@ void cache_reset() { syscall0(SYS_CACHE_RESET); }
 
 int get_block_reads() { return syscall0(SYS_BLK_RD); }
 
-int get_block_writes() { return syscall0(SYS_BLK_WR); }
\ No newline at end of file
+int get_block_writes() { return syscall0(SYS_BLK_WR); }
+
+int read_ahead_hits() { return syscall0(SYS_RA_HITS); }
+
+int read_ahead_misses() { return syscall0(SYS_RA_MISSES); }
+
+int cache_lookups() { return syscall0(SYS_CACHE_LOOKUPS); }
+
+int cache_lookup_compares() { return syscall0(SYS_CACHE_COMPARES); }
@@ -50,6 +50,10 @@ bool sema_init(sema_t* sema, int val);
 void sema_down(sema_t* sema);
 void sema_up(sema_t* sema);
 tid_t get_tid(void);
+bool futex_wait(int* addr, int val);
+int futex_wake(int* addr, int cnt);
+void _thread_register(void);
+void _thread_unregister(void);
 
 /* Project 3 and optionally project 4. */
 mapid_t mmap(int fd, void* addr);
@@ -68,4 +72,10 @@ void cache_reset(void);
 int get_block_reads(void);
 int get_block_writes(void);
 
+int read_ahead_hits(void);
+int read_ahead_misses(void);
+
+int cache_lookups(void);
+int cache_lookup_compares(void);
+
 #endif /* lib/user/syscall.h */
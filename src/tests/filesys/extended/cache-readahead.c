@@ -0,0 +1,43 @@
+/* Reads a file front to back after emptying the cache.  The
+   read-ahead thread should bring in sectors before the reader
+   asks for them, so some of the prefetched sectors are used,
+   and the data read must match what was written. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SECTORS 64
+
+static char buf[512];
+static char expected[512];
+
+void test_main(void) {
+  int fd;
+  char* file_name = "stream";
+  int i;
+
+  random_bytes(expected, sizeof expected);
+
+  CHECK(create(file_name, 0), "create \"%s\"", file_name);
+  CHECK((fd = open(file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < FILE_SECTORS; i++)
+    if (write(fd, expected, sizeof expected) != sizeof expected)
+      break;
+  CHECK(i == FILE_SECTORS, "write %d sectors to \"%s\"", FILE_SECTORS, file_name);
+
+  cache_reset();
+  seek(fd, 0);
+  for (i = 0; i < FILE_SECTORS; i++) {
+    if (read(fd, buf, sizeof buf) != sizeof buf)
+      fail("read of sector %d failed", i);
+    if (memcmp(buf, expected, sizeof buf))
+      fail("sector %d differs from what was written", i);
+  }
+  msg("read \"%s\" sequentially", file_name);
+
+  CHECK(read_ahead_hits() > 0, "prefetched sectors were used");
+  close(fd);
+}
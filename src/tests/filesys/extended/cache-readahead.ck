@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-readahead) begin
+(cache-readahead) create "stream"
+(cache-readahead) open "stream"
+(cache-readahead) write 64 sectors to "stream"
+(cache-readahead) read "stream" sequentially
+(cache-readahead) prefetched sectors were used
+(cache-readahead) end
+EOF
+pass;
\ No newline at end of file
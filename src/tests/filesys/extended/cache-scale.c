@@ -0,0 +1,77 @@
+/* Runs with a 1024-sector buffer cache (see Make.tests) and reads
+   a file that is several times larger than the old fixed 64-slot
+   cache.  The second pass over the file must be served entirely
+   from the cache, and so must reads of its sectors in random
+   order, which would miss if the index lost track of any of the
+   hundreds of resident sectors.
+
+   A cache lookup must also cost about the same whether a handful
+   of sectors or hundreds are resident.  The cost is counted in
+   sector comparisons made by the cache index rather than timed,
+   since cycle counts are too noisy under an emulator to
+   compare. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SECTORS 400
+#define PROBES 1000
+
+static char buf[512];
+
+/* Reads PROBES random sectors among the first SECTORS of FD and
+   returns the sector comparisons per cache lookup they took,
+   times 100. */
+static int probe_cost(int fd, int sectors) {
+  int lookups = cache_lookups();
+  int compares = cache_lookup_compares();
+
+  for (int i = 0; i < PROBES; i++) {
+    seek(fd, random_ulong() % sectors * sizeof buf);
+    read(fd, buf, sizeof buf);
+  }
+  lookups = cache_lookups() - lookups;
+  compares = cache_lookup_compares() - compares;
+  return lookups > 0 ? compares * 100 / lookups : 0;
+}
+
+void test_main(void) {
+  int fd;
+  char* file_name = "scale";
+  int i;
+
+  random_bytes(buf, sizeof buf);
+
+  CHECK(create(file_name, 0), "create \"%s\"", file_name);
+  CHECK((fd = open(file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < FILE_SECTORS; i++)
+    if (write(fd, buf, sizeof buf) != sizeof buf)
+      break;
+  CHECK(i == FILE_SECTORS, "write %d sectors to \"%s\"", FILE_SECTORS, file_name);
+
+  cache_reset();
+  int sparse_cost = probe_cost(fd, 1);
+
+  seek(fd, 0);
+  for (i = 0; i < FILE_SECTORS; i++)
+    read(fd, buf, sizeof buf);
+  msg("first pass over \"%s\"", file_name);
+
+  int reads = get_block_reads();
+  seek(fd, 0);
+  for (i = 0; i < FILE_SECTORS; i++)
+    read(fd, buf, sizeof buf);
+  int second_pass_reads = get_block_reads() - reads;
+  CHECK(second_pass_reads == 0, "second pass served from cache");
+
+  reads = get_block_reads();
+  int full_cost = probe_cost(fd, FILE_SECTORS);
+  int probe_reads = get_block_reads() - reads;
+  CHECK(probe_reads == 0, "random probes served from cache");
+
+  CHECK(sparse_cost > 0 && full_cost < 4 * sparse_cost,
+        "lookup cost does not grow with resident sectors");
+  close(fd);
+}
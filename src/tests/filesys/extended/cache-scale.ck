@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-scale) begin
+(cache-scale) create "scale"
+(cache-scale) open "scale"
+(cache-scale) write 400 sectors to "scale"
+(cache-scale) first pass over "scale"
+(cache-scale) second pass served from cache
+(cache-scale) random probes served from cache
+(cache-scale) lookup cost does not grow with resident sectors
+(cache-scale) end
+EOF
+pass;
\ No newline at end of file
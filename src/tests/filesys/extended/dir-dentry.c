@@ -0,0 +1,29 @@
+/* Checks that cached path lookups follow changes to the
+   directory tree: a name that was looked up while absent can be
+   created, a removed name stops resolving, and a directory that
+   is removed and recreated starts out empty. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  int fd;
+
+  CHECK(mkdir("/d"), "mkdir \"/d\"");
+  CHECK(open("/d/a") == -1, "open \"/d/a\" (must fail)");
+  CHECK(create("/d/a", 0), "create \"/d/a\"");
+  CHECK((fd = open("/d/a")) > 1, "open \"/d/a\"");
+  close(fd);
+
+  CHECK(remove("/d/a"), "remove \"/d/a\"");
+  CHECK(open("/d/a") == -1, "open \"/d/a\" (must fail)");
+  CHECK(create("/d/a", 0), "create \"/d/a\"");
+  CHECK((fd = open("/d/a")) > 1, "open \"/d/a\"");
+  close(fd);
+
+  CHECK(remove("/d/a"), "remove \"/d/a\"");
+  CHECK(remove("/d"), "remove \"/d\"");
+  CHECK(mkdir("/d"), "mkdir \"/d\"");
+  CHECK(open("/d/a") == -1, "open \"/d/a\" (must fail)");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-dentry) begin
+(dir-dentry) mkdir "/d"
+(dir-dentry) open "/d/a" (must fail)
+(dir-dentry) create "/d/a"
+(dir-dentry) open "/d/a"
+(dir-dentry) remove "/d/a"
+(dir-dentry) open "/d/a" (must fail)
+(dir-dentry) create "/d/a"
+(dir-dentry) open "/d/a"
+(dir-dentry) remove "/d/a"
+(dir-dentry) remove "/d"
+(dir-dentry) mkdir "/d"
+(dir-dentry) open "/d/a" (must fail)
+(dir-dentry) end
+EOF
+pass;
\ No newline at end of file
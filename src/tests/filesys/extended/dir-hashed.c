@@ -0,0 +1,47 @@
+/* Creates enough files in one directory to make it rehash
+   several times, removes every other one, and checks that
+   lookups and readdir see exactly the files that remain. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+
+void test_main(void) {
+  char name[16];
+  char entry[READDIR_MAX_LEN + 1];
+  int fd, cnt, i;
+
+  CHECK(mkdir("/h"), "mkdir \"/h\"");
+  for (i = 0; i < FILE_CNT; i++) {
+    snprintf(name, sizeof name, "/h/f%d", i);
+    if (!create(name, 0))
+      fail("create \"%s\" failed", name);
+  }
+  msg("created %d files in \"/h\"", FILE_CNT);
+
+  for (i = 1; i < FILE_CNT; i += 2) {
+    snprintf(name, sizeof name, "/h/f%d", i);
+    if (!remove(name))
+      fail("remove \"%s\" failed", name);
+  }
+  msg("removed odd-numbered files");
+
+  for (i = 0; i < FILE_CNT; i++) {
+    snprintf(name, sizeof name, "/h/f%d", i);
+    fd = open(name);
+    if ((fd > 1) != (i % 2 == 0))
+      fail("open \"%s\" returned %d", name, fd);
+    if (fd > 1)
+      close(fd);
+  }
+  msg("lookups match the remaining files");
+
+  CHECK((fd = open("/h")) > 1, "open \"/h\"");
+  for (cnt = 0; readdir(fd, entry); cnt++)
+    continue;
+  CHECK(cnt == FILE_CNT / 2, "readdir \"/h\" returns %d entries", cnt);
+  close(fd);
+}
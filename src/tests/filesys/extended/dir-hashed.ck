@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hashed) begin
+(dir-hashed) mkdir "/h"
+(dir-hashed) created 200 files in "/h"
+(dir-hashed) removed odd-numbered files
+(dir-hashed) lookups match the remaining files
+(dir-hashed) open "/h"
+(dir-hashed) readdir "/h" returns 100 entries
+(dir-hashed) end
+EOF
+pass;
\ No newline at end of file
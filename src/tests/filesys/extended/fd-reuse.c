@@ -0,0 +1,39 @@
+/* Opens one file many times over, then checks that closed
+   descriptors are handed out again lowest first and that every
+   descriptor still refers to its own open file. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FD_CNT 100
+
+static int fds[FD_CNT];
+
+void test_main(void) {
+  int i;
+
+  CHECK(create("a", 0), "create \"a\"");
+  msg("open \"a\" %d times", FD_CNT);
+  for (i = 0; i < FD_CNT; i++) {
+    fds[i] = open("a");
+    if (fds[i] < 2)
+      fail("open #%d failed", i);
+    if (i > 0 && fds[i] != fds[i - 1] + 1)
+      fail("open #%d returned fd %d after fd %d", i, fds[i], fds[i - 1]);
+  }
+
+  msg("seek each fd to its own offset");
+  for (i = 0; i < FD_CNT; i++)
+    seek(fds[i], i);
+  for (i = 0; i < FD_CNT; i++)
+    if (tell(fds[i]) != (unsigned)i)
+      fail("tell(fd %d) returned %u, expected %d", fds[i], tell(fds[i]), i);
+
+  msg("close fds 50 and 10");
+  close(fds[50]);
+  close(fds[10]);
+  CHECK(open("a") == fds[10], "reopen gets fd of #10");
+  CHECK(open("a") == fds[50], "reopen gets fd of #50");
+  CHECK(open("a") == fds[FD_CNT - 1] + 1, "next open gets a new fd");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fd-reuse) begin
+(fd-reuse) create "a"
+(fd-reuse) open "a" 100 times
+(fd-reuse) seek each fd to its own offset
+(fd-reuse) close fds 50 and 10
+(fd-reuse) reopen gets fd of #10
+(fd-reuse) reopen gets fd of #50
+(fd-reuse) next open gets a new fd
+(fd-reuse) end
+EOF
+pass;
\ No newline at end of file
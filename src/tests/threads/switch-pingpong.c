@@ -0,0 +1,101 @@
+/* Measures the cost of a context switch.  The main thread and a
+   second thread pass a pair of semaphores back and forth for
+   ROUNDS round trips, so that every down blocks and every round
+   trip is two switches.  In the second run both threads touch
+   the FPU between switches, so each switch also takes the
+   device-not-available trap that moves the FPU state to its new
+   owner (see threads/interrupt.c).  Both runs are repeated with
+   the FPU state switched eagerly, saved and loaded on every
+   switch as before lazy switching, for comparison.
+
+   Cycle counts depend on the machine and are only reported.  The
+   test checks that every hand-off happened. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ROUNDS 1000
+
+/* State shared by the two threads. */
+struct pingpong {
+  struct semaphore ping; /* Upped by the main thread. */
+  struct semaphore pong; /* Upped by the ponger. */
+  struct semaphore done; /* Upped when the ponger is finished. */
+  bool fpu;              /* Touch the FPU before each hand-off? */
+  int returns;           /* Hand-offs back to the main thread. */
+};
+
+static thread_func ponger;
+
+/* Reads the processor's time-stamp counter. */
+static unsigned long long rdtsc(void) {
+  unsigned long long tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/* Executes one FPU instruction, which traps unless the FPU holds
+   the current thread's state. */
+static void touch_fpu(void) { asm volatile("fld1; fstp %%st(0)" : : : "memory"); }
+
+/* Runs ROUNDS round trips between the main thread and a new
+   thread, touching the FPU each time if FPU is true, and returns
+   the average cycles per switch. */
+static unsigned long long pingpong(bool fpu) {
+  struct pingpong pp;
+  unsigned long long start, cycles;
+
+  sema_init(&pp.ping, 0);
+  sema_init(&pp.pong, 0);
+  sema_init(&pp.done, 0);
+  pp.fpu = fpu;
+  pp.returns = 0;
+  thread_create("ponger", PRI_DEFAULT, ponger, &pp);
+
+  /* One untimed round trip, so that the ponger is already
+     waiting on PING when timing starts. */
+  sema_up(&pp.ping);
+  sema_down(&pp.pong);
+
+  start = rdtsc();
+  for (int i = 0; i < ROUNDS; i++) {
+    if (fpu)
+      touch_fpu();
+    sema_up(&pp.ping);
+    sema_down(&pp.pong);
+  }
+  cycles = rdtsc() - start;
+
+  sema_down(&pp.done);
+  if (pp.returns != ROUNDS + 1)
+    fail("%d hand-offs instead of %d", pp.returns, ROUNDS + 1);
+  return cycles / (2 * ROUNDS);
+}
+
+void test_switch_pingpong(void) {
+  msg("lazy FPU: %llu cycles per switch", pingpong(false));
+  msg("lazy FPU: %llu cycles per switch with FPU use", pingpong(true));
+
+  fpu_set_eager(true);
+  msg("eager FPU: %llu cycles per switch", pingpong(false));
+  msg("eager FPU: %llu cycles per switch with FPU use", pingpong(true));
+  fpu_set_eager(false);
+}
+
+/* Second thread: answers every PING with a PONG. */
+static void ponger(void* pp_) {
+  struct pingpong* pp = pp_;
+
+  for (int i = 0; i < ROUNDS + 1; i++) {
+    sema_down(&pp->ping);
+    if (pp->fpu)
+      touch_fpu();
+    pp->returns++;
+    sema_up(&pp->pong);
+  }
+  sema_up(&pp->done);
+}
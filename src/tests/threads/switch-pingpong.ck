@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+s/^(\(switch-pingpong\) \w+ FPU:) \d+ cycles/$1 N cycles/ foreach @output;
+common_checks ("run", @output);
+compare_output ("run", \@output, [<<'EOF']);
+(switch-pingpong) begin
+(switch-pingpong) lazy FPU: N cycles per switch
+(switch-pingpong) lazy FPU: N cycles per switch with FPU use
+(switch-pingpong) eager FPU: N cycles per switch
+(switch-pingpong) eager FPU: N cycles per switch with FPU use
+(switch-pingpong) end
+EOF
+pass;
@@ -0,0 +1,31 @@
+/* Tests that futex_wait won't sleep on a word that has changed
+   and that futex_wake wakes a thread sleeping on a word */
+
+#include "tests/lib.h"
+#include "tests/main.h"
+#include <pthread.h>
+#include <syscall.h>
+
+void thread_function(void* arg_);
+
+static int word;
+
+/* Sleeps until main sets WORD */
+void thread_function(void* arg_ UNUSED) {
+  while (word == 0)
+    futex_wait(&word, 0);
+  msg("Thread woke up");
+}
+
+void test_main(void) {
+  if (futex_wait(&word, 1))
+    fail("Slept on a changed word");
+  if (futex_wake(&word, 1) != 0)
+    fail("Woke a thread that was not asleep");
+
+  tid_t tid = pthread_check_create(thread_function, NULL);
+  word = 1;
+  futex_wake(&word, 1);
+  pthread_check_join(tid);
+  msg("PASS");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(futex-simple) begin
+(futex-simple) Thread woke up
+(futex-simple) PASS
+(futex-simple) end
+futex-simple: exit(0)
+EOF
+pass;
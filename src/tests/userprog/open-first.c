@@ -0,0 +1,14 @@
+/* Opens the first file of a fresh process, whose fd table has not
+   been allocated yet, and reads it back through the new fd. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  int handle;
+
+  CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+  check_file_handle(handle, "sample.txt", sample, sizeof sample - 1);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(open-first) begin
+(open-first) open "sample.txt"
+(open-first) verified contents of "sample.txt"
+(open-first) end
+open-first: exit(0)
+EOF
+pass;
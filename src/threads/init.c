@@ -34,6 +34,10 @@
 #ifdef THREADS
 #include "tests/threads/tests.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
@@ -55,6 +59,12 @@ static const char* scratch_bdev_name;
 #ifdef VM
 static const char* swap_bdev_name;
 #endif
+
+/* -cache: Number of sectors held by the buffer cache. */
+static size_t cache_sector_cnt = CACHE_DEFAULT_SECTORS;
+
+/* -readahead: Sectors to prefetch past a sequential reader. */
+static size_t read_ahead_cnt = READ_AHEAD_DEFAULT_SECTORS;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -96,6 +106,9 @@ int main(void) {
   palloc_init(user_page_limit);
   malloc_init();
   paging_init();
+#ifdef VM
+  frame_init();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -127,7 +140,10 @@ int main(void) {
   /* Initialize file system. */
   ide_init();
   locate_block_devices();
-  filesys_init(format_filesys);
+  filesys_init(format_filesys, cache_sector_cnt, read_ahead_cnt);
+#endif
+#ifdef VM
+  swap_init();
 #endif
 
   printf("Boot complete.\n");
@@ -240,6 +256,17 @@ static char** parse_options(char** argv) {
       filesys_bdev_name = value;
     else if (!strcmp(name, "-scratch"))
       scratch_bdev_name = value;
+    else if (!strcmp(name, "-cache")) {
+      int cnt = value != NULL ? atoi(value) : 0;
+      if (cnt < CACHE_MIN_SECTORS)
+        PANIC("-cache must be at least %d sectors (use -h for help)", CACHE_MIN_SECTORS);
+      cache_sector_cnt = cnt;
+    } else if (!strcmp(name, "-readahead")) {
+      int cnt = value != NULL ? atoi(value) : -1;
+      if (cnt < 0)
+        PANIC("-readahead must not be negative (use -h for help)");
+      read_ahead_cnt = cnt;
+    }
 #ifdef VM
     else if (!strcmp(name, "-swap"))
       swap_bdev_name = value;
@@ -420,6 +447,8 @@ static void usage(void) {
          "  -f                 Format file system device during startup.\n"
          "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
          "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+         "  -cache=COUNT       Hold COUNT sectors in the buffer cache.\n"
+         "  -readahead=COUNT   Prefetch COUNT sectors ahead of sequential reads (0=off).\n"
 #ifdef VM
          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif // VM
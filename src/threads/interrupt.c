@@ -11,6 +11,7 @@
 #include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #endif
 
 /* Programmable Interrupt Controller (PIC) registers.
@@ -24,6 +25,28 @@
 /* Number of x86 interrupts. */
 #define INTR_CNT 256
 
+/* Task Switched bit of CR0: the next FPU instruction raises
+   #NM. */
+#define CR0_TS 0x00000008
+
+/* Lazy FPU switching.  The FPU registers are left holding the
+   state of the last thread that used them, FPU_OWNER, across
+   context switches.  Switching to any other thread sets CR0.TS,
+   so that the thread's first FPU instruction traps to
+   fpu_not_available(), which saves the owner's state into the
+   owner's struct thread and loads the new thread's.  Threads that
+   never touch the FPU never pay for it.
+
+   Interrupt handlers must not use the FPU.  Kernel code that uses
+   it on behalf of a user program must save and restore the user
+   program's registers around it. */
+static struct thread* fpu_owner;
+
+/* If true, the FPU state is saved and loaded on every context
+   switch instead, as it was before switching became lazy.  Only
+   for comparing the two, see tests/threads/switch-pingpong.c. */
+static bool fpu_eager;
+
 /* The Interrupt Descriptor Table (IDT).  The format is fixed by
    the CPU.  See [IA32-v3a] sections 5.10 "Interrupt Descriptor
    Table (IDT)", 5.11 "IDT Descriptors", 5.12.1.2 "Flag Usage By
@@ -62,6 +85,8 @@ static inline uint64_t make_idtr_operand(uint16_t limit, void* base);
 /* Interrupt handlers. */
 void intr_handler(struct intr_frame* args);
 static void unexpected_interrupt(const struct intr_frame*);
+static intr_handler_func fpu_not_available;
+static void set_cr0_ts(bool);
 
 /* Returns the current interrupt status. */
 enum intr_level intr_get_level(void) {
@@ -148,6 +173,10 @@ void intr_init(void) {
   intr_names[17] = "#AC Alignment Check Exception";
   intr_names[18] = "#MC Machine-Check Exception";
   intr_names[19] = "#XF SIMD Floating-Point Exception";
+
+  /* No thread owns the FPU yet. */
+  intr_register_int(7, 0, INTR_OFF, fpu_not_available, "#NM Device Not Available Exception");
+  set_cr0_ts(true);
 }
 
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
@@ -196,6 +225,21 @@ void intr_register_int(uint8_t vec_no, int dpl, enum intr_level level, intr_hand
    and false at all other times. */
 bool intr_context(void) { return in_external_intr; }
 
+/* Returns true if external interrupt VEC_NO has been raised but
+   not yet delivered, as while interrupts are off. */
+bool intr_ext_pending(uint8_t vec_no) {
+  ASSERT(vec_no >= 0x20 && vec_no <= 0x2f);
+
+  /* OCW3: read the interrupt request register on the next read. */
+  if (vec_no < 0x28) {
+    outb(PIC0_CTRL, 0x0a);
+    return (inb(PIC0_CTRL) >> (vec_no - 0x20)) & 1;
+  } else {
+    outb(PIC1_CTRL, 0x0a);
+    return (inb(PIC1_CTRL) >> (vec_no - 0x28)) & 1;
+  }
+}
+
 /* During processing of an external interrupt, directs the
    interrupt handler to yield to a new process just before
    returning from the interrupt.  May not be called at any other
@@ -205,6 +249,72 @@ void intr_yield_on_return(void) {
   yield_on_return = true;
 }
 
+/* Lazy FPU switching. */
+
+/* Sets CR0.TS if TS is true, otherwise clears it. */
+static void set_cr0_ts(bool ts) {
+  uint32_t cr0;
+
+  asm volatile("movl %%cr0, %0" : "=r"(cr0));
+  if (ts != ((cr0 & CR0_TS) != 0))
+    asm volatile("movl %0, %%cr0" : : "r"(cr0 ^ CR0_TS));
+}
+
+/* Saves the FPU owner's state and loads T's, or a freshly
+   initialized state if T never used the FPU, making T the owner.
+   CR0.TS must be clear. */
+static void fpu_take(struct thread* t) {
+  if (fpu_owner != NULL)
+    asm volatile("fnsave %0" : "=m"(fpu_owner->fpu));
+  if (t->fpu_used)
+    asm volatile("frstor %0" : : "m"(t->fpu));
+  else {
+    asm volatile("fninit");
+    t->fpu_used = true;
+  }
+  fpu_owner = t;
+}
+
+/* Called when switching to thread T, with interrupts off.  Lets T
+   use the FPU directly if it already holds T's state, and makes
+   T's first FPU instruction trap otherwise. */
+void fpu_switch(struct thread* t) {
+  ASSERT(intr_get_level() == INTR_OFF);
+  if (fpu_eager) {
+    set_cr0_ts(false);
+    fpu_take(t);
+  } else
+    set_cr0_ts(t != fpu_owner);
+}
+
+/* Switches the FPU state eagerly on every context switch if
+   EAGER is true, otherwise lazily. */
+void fpu_set_eager(bool eager) {
+  enum intr_level old_level = intr_disable();
+  fpu_eager = eager;
+  intr_set_level(old_level);
+}
+
+/* Forgets the FPU state of thread T, which is exiting. */
+void fpu_release(struct thread* t) {
+  ASSERT(intr_get_level() == INTR_OFF);
+  if (fpu_owner == t)
+    fpu_owner = NULL;
+}
+
+/* #NM handler: the running thread used the FPU while CR0.TS was
+   set.  Saves the owner's state and loads the running thread's,
+   or a freshly initialized state if it never used the FPU. */
+static void fpu_not_available(struct intr_frame* f UNUSED) {
+  struct thread* cur = thread_current();
+
+  ASSERT(!intr_context());
+
+  asm volatile("clts");
+  if (fpu_owner != cur)
+    fpu_take(cur);
+}
+
 /* 8259A Programmable Interrupt Controller. */
 
 /* Initializes the PICs.  Refer to [8259A] for details.
@@ -354,6 +464,13 @@ void intr_handler(struct intr_frame* frame) {
 
     if (yield_on_return)
       thread_yield();
+
+#ifdef USERPROG
+    /* A thread running user code may never enter the kernel by
+       itself, so this is where it notices its process exiting. */
+    if (frame->cs == SEL_UCSEG)
+      pthread_exit_if_killed();
+#endif
   }
 }
 
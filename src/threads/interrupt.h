@@ -20,7 +20,6 @@ struct intr_frame {
 
   /* Pushed by intr_entry in intr-stubs.S.
        These are the interrupted task's saved registers. */
-  int fpu[27];
   uint32_t edi;       /* Saved EDI. */
   uint32_t esi;       /* Saved ESI. */
   uint32_t ebp;       /* Saved EBP. */
@@ -61,6 +60,14 @@ void intr_init(void);
 void intr_register_ext(uint8_t vec, intr_handler_func*, const char* name);
 void intr_register_int(uint8_t vec, int dpl, enum intr_level, intr_handler_func*, const char* name);
 bool intr_context(void);
+bool intr_ext_pending(uint8_t vec);
+
+/* Lazy FPU switching. */
+#define FPU_SIZE 108 /* Bytes of FPU state saved by FSAVE. */
+struct thread;
+void fpu_switch(struct thread*);
+void fpu_release(struct thread*);
+void fpu_set_eager(bool);
 void intr_yield_on_return(void);
 
 void intr_dump_frame(const struct intr_frame*);
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -26,7 +27,16 @@
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+   and give the arena back to the page allocator.  Each
+   descriptor keeps up to ARENAS_KEPT empty arenas instead, so
+   that a class whose use goes up and down around an arena
+   boundary does not get and free a page every time.
+
+   In front of each descriptor is a magazine, a small stack of
+   free blocks that malloc() and free() use with interrupts off
+   instead of taking the descriptor's lock.  When the magazine is
+   empty, malloc() refills it with a batch of blocks taken under
+   the lock; when it is full, free() drains a batch back.
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
@@ -34,12 +44,29 @@
    with the page allocator and sticking the allocation size at
    the beginning of the allocated block's arena header. */
 
+/* Blocks in a full magazine, and blocks moved between a
+   magazine and its descriptor at a time. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Empty arenas each descriptor keeps rather than freeing. */
+#define ARENAS_KEPT 1
+
 /* Descriptor. */
 struct desc {
   size_t block_size;       /* Size of each element in bytes. */
   size_t blocks_per_arena; /* Number of blocks in an arena. */
   struct list free_list;   /* List of free blocks. */
+  size_t empty_cnt;        /* Arenas with no blocks in use. */
   struct lock lock;        /* Lock. */
+
+  /* Magazine, only touched with interrupts off. */
+  struct block* mag[MAG_SIZE]; /* Free blocks not on FREE_LIST. */
+  size_t mag_cnt;              /* Number of blocks in MAG. */
+
+  /* Statistics, under LOCK. */
+  long long arenas_got;   /* Arenas obtained from the page allocator. */
+  long long arenas_freed; /* Arenas given back to it. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -63,6 +90,8 @@ static size_t desc_cnt;       /* Number of descriptors. */
 
 static struct arena* block_to_arena(struct block*);
 static struct block* arena_to_block(struct arena*, size_t idx);
+static size_t desc_get_blocks(struct desc*, struct block**, size_t cnt);
+static void desc_put_blocks(struct desc*, struct block**, size_t cnt);
 
 /* Initializes the malloc() descriptors. */
 void malloc_init(void) {
@@ -74,7 +103,10 @@ void malloc_init(void) {
     d->block_size = block_size;
     d->blocks_per_arena = (PGSIZE - sizeof(struct arena)) / block_size;
     list_init(&d->free_list);
+    d->empty_cnt = 0;
     lock_init(&d->lock);
+    d->mag_cnt = 0;
+    d->arenas_got = d->arenas_freed = 0;
   }
 }
 
@@ -84,6 +116,9 @@ void* malloc(size_t size) {
   struct desc* d;
   struct block* b;
   struct arena* a;
+  struct block* batch[MAG_BATCH];
+  size_t cnt;
+  enum intr_level old_level;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -110,34 +145,30 @@ void* malloc(size_t size) {
     return a + 1;
   }
 
-  lock_acquire(&d->lock);
+  /* Take a block from the magazine if it has one. */
+  old_level = intr_disable();
+  if (d->mag_cnt > 0) {
+    b = d->mag[--d->mag_cnt];
+    intr_set_level(old_level);
+    return b;
+  }
+  intr_set_level(old_level);
 
-  /* If the free list is empty, create a new arena. */
-  if (list_empty(&d->free_list)) {
-    size_t i;
+  /* Otherwise get a batch from the descriptor, keep one and
+     put the rest in the magazine. */
+  cnt = desc_get_blocks(d, batch, MAG_BATCH);
+  if (cnt == 0)
+    return NULL;
+  b = batch[--cnt];
 
-    /* Allocate a page. */
-    a = palloc_get_page(0);
-    if (a == NULL) {
-      lock_release(&d->lock);
-      return NULL;
-    }
+  old_level = intr_disable();
+  while (cnt > 0 && d->mag_cnt < MAG_SIZE)
+    d->mag[d->mag_cnt++] = batch[--cnt];
+  intr_set_level(old_level);
 
-    /* Initialize arena and add its blocks to the free list. */
-    a->magic = ARENA_MAGIC;
-    a->desc = d;
-    a->free_cnt = d->blocks_per_arena;
-    for (i = 0; i < d->blocks_per_arena; i++) {
-      struct block* b = arena_to_block(a, i);
-      list_push_back(&d->free_list, &b->free_elem);
-    }
-  }
-
-  /* Get a block from free list and return it. */
-  b = list_entry(list_pop_front(&d->free_list), struct block, free_elem);
-  a = block_to_arena(b);
-  a->free_cnt--;
-  lock_release(&d->lock);
+  /* Another thread refilled the magazine meanwhile. */
+  if (cnt > 0)
+    desc_put_blocks(d, batch, cnt);
   return b;
 }
 
@@ -207,30 +238,114 @@ void free(void* p) {
       memset(b, 0xcc, d->block_size);
 #endif
 
-      lock_acquire(&d->lock);
+      struct block* batch[MAG_BATCH];
+      size_t cnt = 0;
+      enum intr_level old_level;
+
+      /* Put the block in the magazine, first draining a batch
+         from it if it is full. */
+      old_level = intr_disable();
+      if (d->mag_cnt == MAG_SIZE)
+        while (cnt < MAG_BATCH)
+          batch[cnt++] = d->mag[--d->mag_cnt];
+      d->mag[d->mag_cnt++] = b;
+      intr_set_level(old_level);
+
+      if (cnt > 0)
+        desc_put_blocks(d, batch, cnt);
+    } else {
+      /* It's a big block.  Free its pages. */
+      palloc_free_multiple(a, a->free_cnt);
+      return;
+    }
+  }
+}
 
-      /* Add block to free list. */
-      list_push_front(&d->free_list, &b->free_elem);
+/* Takes up to CNT free blocks from D into BLOCKS, obtaining a
+   new arena if D has none.  Returns the number taken, which is
+   0 only if memory is not available. */
+static size_t desc_get_blocks(struct desc* d, struct block** blocks, size_t cnt) {
+  size_t taken = 0;
 
-      /* If the arena is now entirely unused, free it. */
-      if (++a->free_cnt >= d->blocks_per_arena) {
-        size_t i;
+  lock_acquire(&d->lock);
 
-        ASSERT(a->free_cnt == d->blocks_per_arena);
-        for (i = 0; i < d->blocks_per_arena; i++) {
-          struct block* b = arena_to_block(a, i);
-          list_remove(&b->free_elem);
-        }
-        palloc_free_page(a);
-      }
+  /* If the free list is empty, create a new arena. */
+  if (list_empty(&d->free_list)) {
+    struct arena* a = palloc_get_page(0);
+    size_t i;
 
+    if (a == NULL) {
       lock_release(&d->lock);
-    } else {
-      /* It's a big block.  Free its pages. */
-      palloc_free_multiple(a, a->free_cnt);
-      return;
+      return 0;
+    }
+
+    /* Initialize arena and add its blocks to the free list. */
+    a->magic = ARENA_MAGIC;
+    a->desc = d;
+    a->free_cnt = d->blocks_per_arena;
+    for (i = 0; i < d->blocks_per_arena; i++) {
+      struct block* b = arena_to_block(a, i);
+      list_push_back(&d->free_list, &b->free_elem);
+    }
+    d->empty_cnt++;
+    d->arenas_got++;
+  }
+
+  /* Get blocks from free list. */
+  while (taken < cnt && !list_empty(&d->free_list)) {
+    struct block* b = list_entry(list_pop_front(&d->free_list), struct block, free_elem);
+    struct arena* a = block_to_arena(b);
+    if (a->free_cnt-- == d->blocks_per_arena)
+      d->empty_cnt--;
+    blocks[taken++] = b;
+  }
+
+  lock_release(&d->lock);
+  return taken;
+}
+
+/* Returns the CNT blocks in BLOCKS to D's free list.  Arenas
+   left with no blocks in use are given back to the page
+   allocator, beyond the ARENAS_KEPT that D holds on to. */
+static void desc_put_blocks(struct desc* d, struct block** blocks, size_t cnt) {
+  lock_acquire(&d->lock);
+  while (cnt-- > 0) {
+    struct block* b = blocks[cnt];
+    struct arena* a = block_to_arena(b);
+
+    /* Add block to free list. */
+    list_push_front(&d->free_list, &b->free_elem);
+
+    /* If the arena is now entirely unused, keep it or free it. */
+    if (++a->free_cnt >= d->blocks_per_arena) {
+      size_t i;
+
+      ASSERT(a->free_cnt == d->blocks_per_arena);
+      if (d->empty_cnt < ARENAS_KEPT) {
+        d->empty_cnt++;
+        continue;
+      }
+      for (i = 0; i < d->blocks_per_arena; i++) {
+        struct block* b = arena_to_block(a, i);
+        list_remove(&b->free_elem);
+      }
+      palloc_free_page(a);
+      d->arenas_freed++;
     }
   }
+  lock_release(&d->lock);
+}
+
+/* Prints malloc() statistics. */
+void malloc_print_stats(void) {
+  long long got = 0;
+  long long freed = 0;
+
+  for (struct desc* d = descs; d < descs + desc_cnt; d++) {
+    got += d->arenas_got;
+    freed += d->arenas_freed;
+  }
+  printf("Malloc: %lld arenas allocated, %lld freed\n", got, freed);
 }
 
 /* Returns the arena that block B is inside. */
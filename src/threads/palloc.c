@@ -2,13 +2,14 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,13 +24,45 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Its free pages form
+   blocks of 2**ORDER pages, aligned to their size relative to
+   the base of the pool, on one free list per order.  A request
+   for N pages takes a block of the smallest order that holds N,
+   splitting a larger block in halves if need be, and gives any
+   pages past the first N back at once.  A freed block is merged
+   with its buddy, the other half of the block of the next order
+   up, for as long as the buddy is free too.  Both take O(log n)
+   steps, so they run with interrupts off rather than under a
+   lock, which also lets a dying thread's page be freed from
+   inside the scheduler.
+
+   Any run of allocated pages may be freed, not only a whole
+   allocation, since a run is freed as the largest aligned blocks
+   that cover it. */
+
+/* Number of block orders.  The largest block is 2**(ORDER_CNT - 1)
+   pages. */
+#define ORDER_CNT 20
+
+/* Value in a pool's order map for pages that do not start a free
+   block. */
+#define NO_ORDER UINT8_MAX
 
 /* A memory pool. */
 struct pool {
-  struct lock lock;        /* Mutual exclusion. */
-  struct bitmap* used_map; /* Bitmap of free pages. */
-  uint8_t* base;           /* Base of pool. */
+  struct bitmap* used_map;     /* Bitmap of free pages. */
+  uint8_t* orders;             /* Order of the free block at each page, or NO_ORDER. */
+  struct list free[ORDER_CNT]; /* Free blocks of each order. */
+  size_t free_cnt[ORDER_CNT];  /* Number of blocks on each free list. */
+  uint8_t* base;               /* Base of pool. */
+  const char* name;            /* Name, for statistics. */
+};
+
+/* A free block, at the start of its first page. */
+struct free_block {
+  struct list_elem elem; /* Element in the pool's free list. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -37,6 +70,8 @@ static struct pool kernel_pool, user_pool;
 
 static void init_pool(struct pool*, void* base, size_t page_cnt, const char* name);
 static bool page_from_pool(const struct pool*, void* page);
+static size_t pool_take(struct pool*, size_t page_cnt);
+static void pool_put(struct pool*, size_t page_idx, size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -66,13 +101,14 @@ void* palloc_get_multiple(enum palloc_flags flags, size_t page_cnt) {
   struct pool* pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void* pages;
   size_t page_idx;
+  enum intr_level old_level;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire(&pool->lock);
-  page_idx = bitmap_scan_and_flip(pool->used_map, 0, page_cnt, false);
-  lock_release(&pool->lock);
+  old_level = intr_disable();
+  page_idx = pool_take(pool, page_cnt);
+  intr_set_level(old_level);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -103,6 +139,7 @@ void* palloc_get_page(enum palloc_flags flags) { return palloc_get_multiple(flag
 void palloc_free_multiple(void* pages, size_t page_cnt) {
   struct pool* pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT(pg_ofs(pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -121,8 +158,9 @@ void palloc_free_multiple(void* pages, size_t page_cnt) {
   memset(pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT(bitmap_all(pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+  old_level = intr_disable();
+  pool_put(pool, page_idx, page_cnt);
+  intr_set_level(old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -131,20 +169,35 @@ void palloc_free_page(void* page) { palloc_free_multiple(page, 1); }
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void init_pool(struct pool* p, void* base, size_t page_cnt, const char* name) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and order map at its base.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP(bitmap_buf_size(page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size(page_cnt);
+  size_t bm_pages = DIV_ROUND_UP(bm_size + page_cnt, PGSIZE);
+  size_t order;
+  enum intr_level old_level;
+
   if (bm_pages > page_cnt)
     PANIC("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
 
   printf("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init(&p->lock);
-  p->used_map = bitmap_create_in_buf(page_cnt, base, bm_pages * PGSIZE);
+  /* Initialize the pool with every page in use, then free them
+     all to build the free lists. */
+  p->used_map = bitmap_create_in_buf(page_cnt, base, bm_size);
+  bitmap_set_all(p->used_map, true);
+  p->orders = (uint8_t*)base + bm_size;
+  memset(p->orders, NO_ORDER, page_cnt);
+  for (order = 0; order < ORDER_CNT; order++) {
+    list_init(&p->free[order]);
+    p->free_cnt[order] = 0;
+  }
   p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+  old_level = intr_disable();
+  pool_put(p, 0, page_cnt);
+  intr_set_level(old_level);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -156,3 +209,120 @@ static bool page_from_pool(const struct pool* pool, void* page) {
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the first page of block PAGE_IDX of POOL. */
+static struct free_block* block_at(struct pool* pool, size_t page_idx) {
+  return (struct free_block*)(pool->base + PGSIZE * page_idx);
+}
+
+/* Puts block PAGE_IDX of POOL, of the given ORDER, on its free
+   list. */
+static void block_push(struct pool* pool, size_t page_idx, size_t order) {
+  pool->orders[page_idx] = order;
+  list_push_front(&pool->free[order], &block_at(pool, page_idx)->elem);
+  pool->free_cnt[order]++;
+}
+
+/* Takes block PAGE_IDX of POOL, of the given ORDER, off its free
+   list. */
+static void block_remove(struct pool* pool, size_t page_idx, size_t order) {
+  ASSERT(pool->orders[page_idx] == order);
+  pool->orders[page_idx] = NO_ORDER;
+  list_remove(&block_at(pool, page_idx)->elem);
+  pool->free_cnt[order]--;
+}
+
+/* Frees block PAGE_IDX of POOL, of the given ORDER, merging it
+   with its buddy for as long as the buddy is free. */
+static void block_free(struct pool* pool, size_t page_idx, size_t order) {
+  size_t page_cnt = bitmap_size(pool->used_map);
+
+  for (; order + 1 < ORDER_CNT; order++) {
+    size_t buddy = page_idx ^ ((size_t)1 << order);
+    if (buddy >= page_cnt || pool->orders[buddy] != order)
+      break;
+    block_remove(pool, buddy, order);
+    if (buddy < page_idx)
+      page_idx = buddy;
+  }
+  block_push(pool, page_idx, order);
+}
+
+/* Marks the PAGE_CNT pages starting at PAGE_IDX in POOL, which
+   must all be in use, as free.  Must be called with interrupts
+   off. */
+static void pool_put(struct pool* pool, size_t page_idx, size_t page_cnt) {
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(bitmap_all(pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+
+  /* Free the run as the largest aligned blocks that fit in it. */
+  while (page_cnt > 0) {
+    size_t order = 0;
+    while (order + 1 < ORDER_CNT && page_idx % ((size_t)2 << order) == 0 &&
+           ((size_t)2 << order) <= page_cnt)
+      order++;
+    block_free(pool, page_idx, order);
+    page_idx += (size_t)1 << order;
+    page_cnt -= (size_t)1 << order;
+  }
+}
+
+/* Marks PAGE_CNT contiguous free pages in POOL as in use and
+   returns the index of the first, or BITMAP_ERROR if there is no
+   free block big enough.  Must be called with interrupts off. */
+static size_t pool_take(struct pool* pool, size_t page_cnt) {
+  size_t want, order, page_idx;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  /* Find the smallest order that holds PAGE_CNT pages, then the
+     smallest free block of at least that order. */
+  for (want = 0; want < ORDER_CNT && ((size_t)1 << want) < page_cnt; want++)
+    continue;
+  for (order = want; order < ORDER_CNT && list_empty(&pool->free[order]); order++)
+    continue;
+  if (order >= ORDER_CNT)
+    return BITMAP_ERROR;
+
+  page_idx = pg_no(list_entry(list_front(&pool->free[order]), struct free_block, elem)) -
+             pg_no(pool->base);
+  block_remove(pool, page_idx, order);
+
+  /* Split off the upper halves until the block is as small as it
+     can be. */
+  while (order > want) {
+    order--;
+    block_push(pool, page_idx + ((size_t)1 << order), order);
+  }
+
+  /* Mark the whole block in use, then give back the pages past
+     PAGE_CNT. */
+  bitmap_set_multiple(pool->used_map, page_idx, (size_t)1 << order, true);
+  if (page_cnt < (size_t)1 << order)
+    pool_put(pool, page_idx + page_cnt, ((size_t)1 << order) - page_cnt);
+  return page_idx;
+}
+
+/* Prints the number of free blocks of each order in POOL. */
+static void pool_print_stats(const struct pool* pool) {
+  size_t free_pages = 0;
+  size_t top = 0;
+  size_t order;
+
+  for (order = 0; order < ORDER_CNT; order++)
+    if (pool->free_cnt[order] > 0) {
+      free_pages += pool->free_cnt[order] << order;
+      top = order;
+    }
+  printf("Palloc: %s: %zu pages free; free blocks by order:", pool->name, free_pages);
+  for (order = 0; order <= top; order++)
+    printf(" %zu", pool->free_cnt[order]);
+  printf("\n");
+}
+
+/* Prints page allocator statistics. */
+void palloc_print_stats(void) {
+  pool_print_stats(&kernel_pool);
+  pool_print_stats(&user_pool);
+}
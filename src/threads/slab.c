@@ -0,0 +1,279 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Typed object caches.
+
+   A cache hands out objects of a single type, each taking exactly
+   the size of the type rather than malloc()'s next power of 2.
+   Objects come from slabs: single pages from the page allocator,
+   each holding a header, a stack of the indexes of its free
+   objects, and then the objects themselves.  The slab an object
+   belongs to is found by rounding its address down to a page.
+
+   A cache keeps its slabs on three lists by how many of their
+   objects are in use, and allocates from a partly used slab
+   whenever there is one, so that the objects of a type stay
+   packed into as few pages as possible.  A slab whose last object
+   is freed goes back to the page allocator, except that each
+   cache keeps up to SLABS_KEPT empty slabs.
+
+   The space a slab's objects leave at the end of its page is used
+   to colour it: each new slab starts its objects one cache line
+   further in than the last, wrapping around, so that objects at
+   the same index in different slabs do not all land in the same
+   cache sets.
+
+   A cache may have a constructor, which is run on each object
+   once, when its slab is created, not on every allocation.  An
+   object must be back in its constructed state when it is
+   freed. */
+
+/* Assumed size of a CPU cache line. */
+#define CACHE_LINE 64
+
+/* Empty slabs each cache keeps rather than freeing. */
+#define SLABS_KEPT 1
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab7e1d
+
+/* Cache of objects of one type. */
+struct kmem_cache {
+  const char* name;      /* Name, for statistics. */
+  size_t obj_size;       /* Size of each object in bytes. */
+  size_t objs_per_slab;  /* Number of objects in a slab. */
+  size_t obj_ofs;        /* Offset of the first object in a slab of colour 0. */
+  size_t colour_cnt;     /* Number of colours. */
+  size_t colour_next;    /* Colour of the next slab created. */
+  kmem_ctor_func* ctor;  /* Constructor, or null. */
+  struct list partial;   /* Slabs with some but not all objects in use. */
+  struct list full;      /* Slabs with all objects in use. */
+  struct list empty;     /* Slabs with no objects in use. */
+  size_t empty_cnt;      /* Number of slabs on EMPTY. */
+  struct lock lock;      /* Lock. */
+  struct list_elem elem; /* Element in CACHES. */
+
+  /* Statistics, under LOCK. */
+  long long allocs;      /* Objects allocated. */
+  long long frees;       /* Objects freed. */
+  long long slabs_got;   /* Slabs obtained from the page allocator. */
+  long long slabs_freed; /* Slabs given back to it. */
+};
+
+/* Slab header, at the start of the slab's page. */
+struct slab {
+  unsigned magic;           /* Always set to SLAB_MAGIC. */
+  struct kmem_cache* cache; /* Owning cache. */
+  struct list_elem elem;    /* Element in one of the cache's slab lists. */
+  uint8_t* objs;            /* First object. */
+  size_t free_cnt;          /* Number of free objects. */
+  uint16_t free_idx[];      /* Indexes of the free objects, as a stack. */
+};
+
+/* All caches, for statistics. */
+static struct list caches = LIST_INITIALIZER(caches);
+
+/* Returns the offset of the first object in a slab of colour 0
+   holding OBJ_CNT objects. */
+static size_t slab_obj_ofs(size_t obj_cnt) {
+  return ROUND_UP(sizeof(struct slab) + obj_cnt * sizeof(uint16_t), CACHE_LINE);
+}
+
+/* Creates and returns a cache of objects of SIZE bytes named
+   NAME.  If CTOR is non-null it is run on each object when the
+   object's slab is created.  Returns a null pointer if memory is
+   not available. */
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, kmem_ctor_func* ctor) {
+  struct kmem_cache* cache;
+  enum intr_level old_level;
+  size_t n;
+
+  ASSERT(size > 0);
+
+  cache = malloc(sizeof *cache);
+  if (cache == NULL)
+    return NULL;
+
+  /* Fit as many objects as the page holds after the header and
+     the free stack, which both grow with the object count. */
+  size = ROUND_UP(size, sizeof(void*));
+  n = (PGSIZE - sizeof(struct slab)) / (size + sizeof(uint16_t));
+  while (n > 0 && slab_obj_ofs(n) + n * size > PGSIZE)
+    n--;
+  ASSERT(n > 0 && n <= UINT16_MAX);
+
+  cache->name = name;
+  cache->obj_size = size;
+  cache->objs_per_slab = n;
+  cache->obj_ofs = slab_obj_ofs(n);
+  cache->colour_cnt = (PGSIZE - cache->obj_ofs - n * size) / CACHE_LINE + 1;
+  cache->colour_next = 0;
+  cache->ctor = ctor;
+  list_init(&cache->partial);
+  list_init(&cache->full);
+  list_init(&cache->empty);
+  cache->empty_cnt = 0;
+  lock_init(&cache->lock);
+  cache->allocs = cache->frees = 0;
+  cache->slabs_got = cache->slabs_freed = 0;
+
+  old_level = intr_disable();
+  list_push_back(&caches, &cache->elem);
+  intr_set_level(old_level);
+  return cache;
+}
+
+/* Obtains a new slab for CACHE, with all of its objects free and
+   constructed, and puts it on CACHE's empty list.  Returns false
+   if memory is not available.  Runs the constructor without the
+   lock held, so the caller must not hold it either. */
+static bool slab_create(struct kmem_cache* cache) {
+  struct slab* s;
+  size_t colour;
+  size_t i;
+
+  s = palloc_get_page(0);
+  if (s == NULL)
+    return false;
+
+  lock_acquire(&cache->lock);
+  colour = cache->colour_next;
+  cache->colour_next = (colour + 1) % cache->colour_cnt;
+  lock_release(&cache->lock);
+
+  s->magic = SLAB_MAGIC;
+  s->cache = cache;
+  s->objs = (uint8_t*)s + cache->obj_ofs + colour * CACHE_LINE;
+  s->free_cnt = cache->objs_per_slab;
+  for (i = 0; i < cache->objs_per_slab; i++) {
+    s->free_idx[i] = cache->objs_per_slab - 1 - i;
+    if (cache->ctor != NULL)
+      cache->ctor(s->objs + i * cache->obj_size);
+  }
+
+  lock_acquire(&cache->lock);
+  list_push_front(&cache->empty, &s->elem);
+  cache->empty_cnt++;
+  cache->slabs_got++;
+  lock_release(&cache->lock);
+  return true;
+}
+
+/* Obtains and returns an object from CACHE.  The object is in its
+   constructed state if CACHE has a constructor and is otherwise
+   uninitialized.  Returns a null pointer if memory is not
+   available. */
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+  struct slab* s;
+  void* obj;
+
+  lock_acquire(&cache->lock);
+  while (list_empty(&cache->partial) && list_empty(&cache->empty)) {
+    lock_release(&cache->lock);
+    if (!slab_create(cache))
+      return NULL;
+    lock_acquire(&cache->lock);
+  }
+
+  if (!list_empty(&cache->partial))
+    s = list_entry(list_front(&cache->partial), struct slab, elem);
+  else {
+    s = list_entry(list_pop_front(&cache->empty), struct slab, elem);
+    list_push_front(&cache->partial, &s->elem);
+    cache->empty_cnt--;
+  }
+
+  obj = s->objs + s->free_idx[--s->free_cnt] * cache->obj_size;
+  if (s->free_cnt == 0) {
+    list_remove(&s->elem);
+    list_push_front(&cache->full, &s->elem);
+  }
+  cache->allocs++;
+  lock_release(&cache->lock);
+  return obj;
+}
+
+/* Obtains and returns an object from CACHE, which must not have a
+   constructor, with all of its bytes set to zero.  Returns a null
+   pointer if memory is not available. */
+void* kmem_cache_zalloc(struct kmem_cache* cache) {
+  void* obj;
+
+  ASSERT(cache->ctor == NULL);
+
+  obj = kmem_cache_alloc(cache);
+  if (obj != NULL)
+    memset(obj, 0, cache->obj_size);
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from CACHE, to
+   CACHE.  OBJ may be a null pointer, in which case nothing
+   happens. */
+void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+  struct slab* s;
+  struct slab* dead = NULL;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  /* Check that OBJ is an object of a valid slab of CACHE. */
+  s = pg_round_down(obj);
+  ASSERT(s->magic == SLAB_MAGIC);
+  ASSERT(s->cache == cache);
+  idx = ((uint8_t*)obj - s->objs) / cache->obj_size;
+  ASSERT(s->objs + idx * cache->obj_size == obj);
+  ASSERT(idx < cache->objs_per_slab);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs. */
+  if (cache->ctor == NULL)
+    memset(obj, 0xcc, cache->obj_size);
+#endif
+
+  lock_acquire(&cache->lock);
+  ASSERT(s->free_cnt < cache->objs_per_slab);
+  if (s->free_cnt == 0) {
+    list_remove(&s->elem);
+    list_push_front(&cache->partial, &s->elem);
+  }
+  s->free_idx[s->free_cnt++] = idx;
+  cache->frees++;
+
+  if (s->free_cnt == cache->objs_per_slab) {
+    list_remove(&s->elem);
+    if (cache->empty_cnt < SLABS_KEPT) {
+      list_push_front(&cache->empty, &s->elem);
+      cache->empty_cnt++;
+    } else {
+      dead = s;
+      cache->slabs_freed++;
+    }
+  }
+  lock_release(&cache->lock);
+
+  if (dead != NULL) {
+    dead->magic = 0;
+    palloc_free_page(dead);
+  }
+}
+
+/* Prints statistics for each cache. */
+void slab_print_stats(void) {
+  for (struct list_elem* e = list_begin(&caches); e != list_end(&caches); e = list_next(e)) {
+    struct kmem_cache* c = list_entry(e, struct kmem_cache, elem);
+    printf("Slab %s: %lld objects allocated, %lld freed; %lld slabs allocated, %lld freed\n",
+           c->name, c->allocs, c->frees, c->slabs_got, c->slabs_freed);
+  }
+}
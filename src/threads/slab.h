@@ -0,0 +1,15 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Constructor run on each object of a new slab. */
+typedef void kmem_ctor_func(void* obj);
+
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, kmem_ctor_func*);
+void* kmem_cache_alloc(struct kmem_cache*) __attribute__((malloc));
+void* kmem_cache_zalloc(struct kmem_cache*) __attribute__((malloc));
+void kmem_cache_free(struct kmem_cache*, void*);
+void slab_print_stats(void);
+
+#endif /* threads/slab.h */
@@ -32,6 +32,27 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Maximum length of a chain of priority donations, so that a
+   cycle of lock waits cannot hang lock_acquire(). */
+#define DONATION_DEPTH_MAX 8
+
+/* Removes and returns the thread to wake from WAITERS, a list of
+   blocked threads: the first one under the FIFO scheduler, and
+   the first one of the highest priority under the strict priority
+   scheduler and the MLFQS.  Priorities can change while threads
+   wait, so the list is not kept sorted. */
+static struct thread* waiter_pop(struct list* waiters) {
+  struct list_elem* max = list_begin(waiters);
+
+  if (active_sched_policy == SCHED_PRIO || active_sched_policy == SCHED_MLFQS)
+    for (struct list_elem* e = list_next(max); e != list_end(waiters); e = list_next(e))
+      if (list_entry(e, struct thread, elem)->priority >
+          list_entry(max, struct thread, elem)->priority)
+        max = e;
+  list_remove(max);
+  return list_entry(max, struct thread, elem);
+}
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -103,9 +124,10 @@ void sema_up(struct semaphore* sema) {
 
   old_level = intr_disable();
   if (!list_empty(&sema->waiters))
-    thread_unblock(list_entry(list_pop_front(&sema->waiters), struct thread, elem));
+    thread_unblock(waiter_pop(&sema->waiters));
   sema->value++;
   intr_set_level(old_level);
+  thread_preempt();
 }
 
 static void sema_test_helper(void* sema_);
@@ -170,12 +192,32 @@ void lock_init(struct lock* lock) {
    interrupts disabled, but interrupts will be turned back on if
    we need to sleep. */
 void lock_acquire(struct lock* lock) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+
   ASSERT(lock != NULL);
   ASSERT(!intr_context());
   ASSERT(!lock_held_by_current_thread(lock));
 
+  old_level = intr_disable();
+  if (lock->holder != NULL && active_sched_policy == SCHED_PRIO) {
+    /* Lend our priority to the holder, and on down the chain of
+       holders it is itself waiting for. */
+    struct thread* t = cur;
+    cur->waiting_lock = lock;
+    for (int depth = 0; depth < DONATION_DEPTH_MAX && t->waiting_lock != NULL; depth++) {
+      struct thread* holder = t->waiting_lock->holder;
+      if (holder == NULL || holder->priority >= t->priority)
+        break;
+      thread_donate_priority(holder, t->priority);
+      t = holder;
+    }
+  }
   sema_down(&lock->semaphore);
-  lock->holder = thread_current();
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  list_push_back(&cur->locks_held, &lock->elem);
+  intr_set_level(old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -185,14 +227,19 @@ void lock_acquire(struct lock* lock) {
    This function will not sleep, so it may be called within an
    interrupt handler. */
 bool lock_try_acquire(struct lock* lock) {
+  enum intr_level old_level;
   bool success;
 
   ASSERT(lock != NULL);
   ASSERT(!lock_held_by_current_thread(lock));
 
+  old_level = intr_disable();
   success = sema_try_down(&lock->semaphore);
-  if (success)
+  if (success) {
     lock->holder = thread_current();
+    list_push_back(&lock->holder->locks_held, &lock->elem);
+  }
+  intr_set_level(old_level);
   return success;
 }
 
@@ -202,10 +249,18 @@ bool lock_try_acquire(struct lock* lock) {
    make sense to try to release a lock within an interrupt
    handler. */
 void lock_release(struct lock* lock) {
+  enum intr_level old_level;
+
   ASSERT(lock != NULL);
   ASSERT(lock_held_by_current_thread(lock));
 
+  /* Give back whatever the waiters on LOCK lent us, before waking
+     one of them so that it can preempt us. */
+  old_level = intr_disable();
+  list_remove(&lock->elem);
   lock->holder = NULL;
+  thread_refresh_priority(thread_current());
+  intr_set_level(old_level);
   sema_up(&lock->semaphore);
 }
 
@@ -282,6 +337,30 @@ struct semaphore_elem {
   struct semaphore semaphore; /* This semaphore. */
 };
 
+/* Removes and returns the waiter to signal from WAITERS, a
+   condition variable's list of semaphore_elems: the first one
+   under the FIFO scheduler, and the first one whose thread has
+   the highest priority under the strict priority scheduler and
+   the MLFQS. */
+static struct semaphore_elem* cond_waiter_pop(struct list* waiters) {
+  struct list_elem* max = list_begin(waiters);
+  int max_priority = -1;
+
+  if (active_sched_policy == SCHED_PRIO || active_sched_policy == SCHED_MLFQS)
+    for (struct list_elem* e = max; e != list_end(waiters); e = list_next(e)) {
+      struct list* sema_waiters = &list_entry(e, struct semaphore_elem, elem)->semaphore.waiters;
+      if (list_empty(sema_waiters))
+        continue;
+      int priority = list_entry(list_front(sema_waiters), struct thread, elem)->priority;
+      if (priority > max_priority) {
+        max_priority = priority;
+        max = e;
+      }
+    }
+  list_remove(max);
+  return list_entry(max, struct semaphore_elem, elem);
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -340,7 +419,7 @@ void cond_signal(struct condition* cond, struct lock* lock UNUSED) {
   ASSERT(lock_held_by_current_thread(lock));
 
   if (!list_empty(&cond->waiters))
-    sema_up(&list_entry(list_pop_front(&cond->waiters), struct semaphore_elem, elem)->semaphore);
+    sema_up(&cond_waiter_pop(&cond->waiters)->semaphore);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
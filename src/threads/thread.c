@@ -12,6 +12,7 @@
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include <stdlib.h>
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -21,15 +22,33 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-static struct list wake_list; // List of sleeping threads
-
 /* List of processes in THREAD_READY state, that is, processes
    that are ready to run but not actually running. */
 static struct list fifo_ready_list;
 
+/* Ready threads for the strict priority scheduler and the
+   MLFQS: a FIFO list per priority, and a bitmap with bit N set
+   when list N is not empty, so that the highest ready priority is
+   a find-first-set away. */
+static struct list prio_ready_lists[PRI_MAX + 1];
+static uint64_t prio_ready_mask;
+static int prio_ready_cnt; /* Number of threads on the lists. */
+
+/* Ready threads for the fair scheduler: a binary min-heap keyed
+   by virtual runtime, the CPU time a thread has used divided by
+   its weight.  The heap lives in pages from the page allocator
+   and is grown by thread_create() so that it always has room for
+   every thread, since threads are made ready from interrupt
+   handlers where it cannot be grown. */
+static struct thread** fair_heap;
+static size_t fair_heap_cnt; /* Number of ready threads. */
+static size_t fair_heap_cap; /* Number of slots in FAIR_HEAP. */
+static int64_t fair_min_vruntime; /* Virtual runtime of the last thread picked. */
+
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
+static size_t all_cnt; /* Number of threads on ALL_LIST. */
 
 /* Idle thread. */
 static struct thread* idle_thread;
@@ -56,11 +75,40 @@ static long long user_ticks;   /* # of timer ticks in user programs. */
 #define TIME_SLICE 4          /* # of timer ticks to give each thread. */
 static unsigned thread_ticks; /* # of timer ticks since last yield. */
 
+/* Fair scheduler weights, indexed by priority.  Each step up in
+   priority is worth 10% more CPU time, so a thread at PRI_MAX
+   gets about 400 times the share of one at PRI_MIN, but no ready
+   thread is ever starved. */
+#define FAIR_WEIGHT_DEFAULT 1024 /* Weight of PRI_DEFAULT. */
+static const int fair_weights[PRI_MAX + 1] = {
+       53,    59,    65,    71,    78,    86,    95,   104,
+      114,   126,   138,   152,   167,   184,   203,   223,
+      245,   270,   297,   326,   359,   395,   434,   478,
+      525,   578,   636,   699,   769,   846,   931,  1024,
+     1126,  1239,  1363,  1499,  1649,  1814,  1995,  2195,
+     2415,  2656,  2922,  3214,  3535,  3889,  4278,  4705,
+     5176,  5693,  6263,  6889,  7578,  8336,  9169, 10086,
+    11095, 12204, 13425, 14767, 16244, 17868, 19655, 21621};
+
+/* MLFQS.  Every thread's recent_cpu and the system load average
+   are recomputed once a second, along with the priorities that
+   depend on them.  In between, only the running thread's
+   recent_cpu changes, so only its priority has to be recomputed
+   every MLFQS_PRI_TICKS ticks. */
+#define MLFQS_PRI_TICKS 4 /* # of timer ticks between priority updates. */
+#define NICE_MIN -20      /* Lowest nice value. */
+#define NICE_MAX 20       /* Highest nice value. */
+static fixed_point_t load_avg; /* Estimated number of threads ready to run. */
+
 static void init_thread(struct thread*, const char* name, int priority);
 static bool is_thread(struct thread*) UNUSED;
 static void* alloc_frame(struct thread*, size_t size);
 static void schedule(void);
 static void thread_enqueue(struct thread* t);
+static bool prio_queued(void);
+static void mlfqs_tick(struct thread* t);
+static void mlfqs_update_priority(struct thread* t);
+static bool fair_heap_reserve(size_t cnt);
 static tid_t allocate_tid(void);
 void thread_switch_tail(struct thread* prev);
 
@@ -111,11 +159,10 @@ void thread_init(void) {
 
   lock_init(&tid_lock);
   list_init(&fifo_ready_list);
+  for (int i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init(&prio_ready_lists[i]);
   list_init(&all_list);
 
-  // Setup alarm clock stuff
-  list_init(&wake_list);
-
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread();
   init_thread(initial_thread, "main", PRI_DEFAULT);
@@ -138,10 +185,6 @@ void thread_start(void) {
   sema_down(&idle_started);
 }
 
-struct list* get_wake_list() {
-  return &wake_list;
-}
-
 /* Called by the timer interrupt handler at each timer tick.
    Thus, this function runs in an external interrupt context. */
 void thread_tick(void) {
@@ -156,19 +199,14 @@ void thread_tick(void) {
 #endif
   else
     kernel_ticks++;
-  for (struct list_elem* e; !list_empty(&wake_list);) {
-    e = list_pop_front(&wake_list);
-    wake_node* cur = list_entry(e, wake_node, elem);
-    if (cur->timestamp <= timer_ticks()) {
-      enum intr_level old_level = intr_disable();
-      //if (cur->t->priority > thread_current()->priority) intr_yield_on_return();
-      thread_unblock(cur->t);
-      intr_set_level(old_level);
-    } else {
-      list_push_front(&wake_list, e);
-      break;
-    }
-  }
+
+  /* Charge the tick to the running thread's virtual runtime,
+     scaled so that heavier threads age more slowly. */
+  if (active_sched_policy == SCHED_FAIR && t != idle_thread)
+    t->vruntime += (FAIR_WEIGHT_DEFAULT << 10) / fair_weights[t->priority];
+  else if (active_sched_policy == SCHED_MLFQS)
+    mlfqs_tick(t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return();
@@ -204,14 +242,26 @@ tid_t thread_create(const char* name, int priority, thread_func* function, void*
 
   ASSERT(function != NULL);
 
+  /* Make sure the fair scheduler can hold one more ready thread. */
+  if (active_sched_policy == SCHED_FAIR && !fair_heap_reserve(all_cnt + 1))
+    return TID_ERROR;
+
   /* Allocate thread. */
   t = palloc_get_page(PAL_ZERO);
   if (t == NULL)
     return TID_ERROR;
 
-  /* Initialize thread. */
+  /* Initialize thread.  Under the MLFQS the new thread inherits
+     its creator's nice and recent_cpu, which set its priority. */
   init_thread(t, name, priority);
   tid = t->tid = allocate_tid();
+  if (active_sched_policy == SCHED_MLFQS) {
+    enum intr_level old_level = intr_disable();
+    t->nice = thread_current()->nice;
+    t->recent_cpu = thread_current()->recent_cpu;
+    mlfqs_update_priority(t);
+    intr_set_level(old_level);
+  }
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame(t, sizeof *kf);
@@ -227,13 +277,10 @@ tid_t thread_create(const char* name, int priority, thread_func* function, void*
   sf = alloc_frame(t, sizeof *sf);
   sf->eip = switch_entry;
   sf->ebp = 0;
-  char temp_fpu[108];
-  asm("fsave (%0); fninit; fsave (%1); frstor (%2)"
-      :
-      : "g"(&temp_fpu), "g"(sf->fpu), "g"(&temp_fpu));
 
   /* Add to run queue. */
   thread_unblock(t);
+  thread_preempt();
 
   return tid;
 }
@@ -252,6 +299,98 @@ void thread_block(void) {
   schedule();
 }
 
+/* Returns true if ready thread A should run before ready thread
+   B under the fair scheduler. */
+static bool fair_before(const struct thread* a, const struct thread* b) {
+  return a->vruntime < b->vruntime;
+}
+
+/* Stores T at slot IDX of the fair scheduler's heap. */
+static void fair_heap_set(size_t idx, struct thread* t) {
+  fair_heap[idx] = t;
+  t->fair_idx = idx;
+}
+
+/* Moves the thread at slot IDX of the heap up or down until the
+   heap is ordered again. */
+static void fair_heap_fix(size_t idx) {
+  struct thread* t = fair_heap[idx];
+
+  while (idx > 0 && fair_before(t, fair_heap[(idx - 1) / 2])) {
+    fair_heap_set(idx, fair_heap[(idx - 1) / 2]);
+    idx = (idx - 1) / 2;
+  }
+  for (;;) {
+    size_t child = 2 * idx + 1;
+    if (child >= fair_heap_cnt)
+      break;
+    if (child + 1 < fair_heap_cnt && fair_before(fair_heap[child + 1], fair_heap[child]))
+      child++;
+    if (!fair_before(fair_heap[child], t))
+      break;
+    fair_heap_set(idx, fair_heap[child]);
+    idx = child;
+  }
+  fair_heap_set(idx, t);
+}
+
+/* Adds T to the fair scheduler's heap. */
+static void fair_heap_push(struct thread* t) {
+  ASSERT(fair_heap_cnt < fair_heap_cap);
+
+  fair_heap_set(fair_heap_cnt++, t);
+  fair_heap_fix(t->fair_idx);
+}
+
+/* Removes the thread at slot IDX of the fair scheduler's heap. */
+static void fair_heap_remove(size_t idx) {
+  ASSERT(idx < fair_heap_cnt);
+
+  if (idx != --fair_heap_cnt) {
+    fair_heap_set(idx, fair_heap[fair_heap_cnt]);
+    fair_heap_fix(idx);
+  }
+}
+
+/* Grows the fair scheduler's heap, if necessary, to hold at least
+   CNT threads.  Returns false if memory is short.  Must not be
+   called from an interrupt handler. */
+static bool fair_heap_reserve(size_t cnt) {
+  struct thread** old_heap;
+  struct thread** new_heap;
+  size_t old_cap, new_cap;
+  enum intr_level old_level;
+
+  ASSERT(!intr_context());
+
+  if (cnt <= fair_heap_cap)
+    return true;
+
+  new_cap = PGSIZE / sizeof *fair_heap;
+  while (new_cap < cnt)
+    new_cap *= 2;
+  new_heap = palloc_get_multiple(0, new_cap * sizeof *fair_heap / PGSIZE);
+  if (new_heap == NULL)
+    return false;
+
+  /* Another thread may have grown the heap meanwhile. */
+  old_level = intr_disable();
+  old_heap = fair_heap;
+  old_cap = fair_heap_cap;
+  if (new_cap > fair_heap_cap) {
+    memcpy(new_heap, fair_heap, fair_heap_cnt * sizeof *fair_heap);
+    fair_heap = new_heap;
+    fair_heap_cap = new_cap;
+  } else {
+    old_heap = new_heap;
+    old_cap = new_cap;
+  }
+  intr_set_level(old_level);
+
+  palloc_free_multiple(old_heap, old_cap * sizeof *fair_heap / PGSIZE);
+  return true;
+}
+
 /* Places a thread on the ready structure appropriate for the
    current active scheduling policy.
    
@@ -262,10 +401,51 @@ static void thread_enqueue(struct thread* t) {
 
   if (active_sched_policy == SCHED_FIFO)
     list_push_back(&fifo_ready_list, &t->elem);
+  else if (prio_queued()) {
+    list_push_back(&prio_ready_lists[t->priority], &t->elem);
+    prio_ready_mask |= (uint64_t)1 << t->priority;
+    prio_ready_cnt++;
+  } else if (active_sched_policy == SCHED_FAIR)
+    fair_heap_push(t);
   else
     PANIC("Unimplemented scheduling policy value: %d", active_sched_policy);
 }
 
+/* Takes ready thread T off the ready structure, undoing
+   thread_enqueue().  Only needed for the policies whose ready
+   structure depends on priority.  Interrupts must be off. */
+static void thread_dequeue(struct thread* t) {
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(t->status == THREAD_READY);
+
+  if (prio_queued()) {
+    list_remove(&t->elem);
+    if (list_empty(&prio_ready_lists[t->priority]))
+      prio_ready_mask &= ~((uint64_t)1 << t->priority);
+    prio_ready_cnt--;
+  } else if (active_sched_policy == SCHED_FAIR)
+    fair_heap_remove(t->fair_idx);
+}
+
+/* Returns true if the active scheduler keeps ready threads on
+   the per-priority lists. */
+static bool prio_queued(void) {
+  return active_sched_policy == SCHED_PRIO || active_sched_policy == SCHED_MLFQS;
+}
+
+/* Returns the highest priority with a ready thread on the
+   per-priority lists, or -1 if no thread is ready. */
+static int prio_highest_ready(void) {
+  uint32_t high = prio_ready_mask >> 32;
+  uint32_t low = prio_ready_mask;
+
+  if (high != 0)
+    return 63 - __builtin_clz(high);
+  if (low != 0)
+    return 31 - __builtin_clz(low);
+  return -1;
+}
+
 /* Transitions a blocked thread T to the ready-to-run state.
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
@@ -281,8 +461,24 @@ void thread_unblock(struct thread* t) {
 
   old_level = intr_disable();
   ASSERT(t->status == THREAD_BLOCKED);
+
+  /* A new or waking thread starts level with the threads that
+     kept running, so that it neither owns the CPU while it catches
+     up nor is left behind by the time it slept. */
+  if (t->vruntime < fair_min_vruntime)
+    t->vruntime = fair_min_vruntime;
   thread_enqueue(t);
   t->status = THREAD_READY;
+
+  /* A thread woken while the CPU idles must not wait out a timer
+     period that timer_idle() stretched. */
+  if (intr_context())
+    timer_wake();
+
+  /* An interrupt handler can always ask for a yield on return,
+     since that happens after it is done. */
+  if (intr_context() && prio_queued() && t->priority > thread_current()->priority)
+    intr_yield_on_return();
   intr_set_level(old_level);
 }
 
@@ -319,6 +515,7 @@ void thread_exit(void) {
      when it calls thread_switch_tail(). */
   intr_disable();
   list_remove(&thread_current()->allelem);
+  all_cnt--;
   thread_current()->status = THREAD_DYING;
   schedule();
   NOT_REACHED();
@@ -353,34 +550,177 @@ void thread_foreach(thread_action_func* func, void* aux) {
   }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
-void thread_set_priority(int new_priority) { thread_current()->priority = new_priority; }
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching ready list if it is waiting to run.  Interrupts must
+   be off. */
+static void thread_set_effective_priority(struct thread* t, int priority) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (t->status == THREAD_READY && t != idle_thread) {
+    thread_dequeue(t);
+    t->priority = priority;
+    thread_enqueue(t);
+  } else
+    t->priority = priority;
+}
+
+/* Sets the current thread's priority to NEW_PRIORITY.  Donations
+   still in effect keep its effective priority up.  Yields if it
+   no longer has the highest priority.  Ignored under the MLFQS,
+   which sets priorities itself. */
+void thread_set_priority(int new_priority) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+
+  ASSERT(PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (active_sched_policy == SCHED_MLFQS)
+    return;
+
+  old_level = intr_disable();
+  cur->base_priority = new_priority;
+  thread_refresh_priority(cur);
+  intr_set_level(old_level);
+  thread_preempt();
+}
 
 /* Returns the current thread's priority. */
 int thread_get_priority(void) { return thread_current()->priority; }
 
-/* Sets the current thread's nice value to NICE. */
-void thread_set_nice(int nice UNUSED) { /* Not yet implemented. */
+/* Raises T's effective priority to PRIORITY, if that is higher,
+   for as long as T holds a lock a thread of that priority waits
+   for.  Interrupts must be off. */
+void thread_donate_priority(struct thread* t, int priority) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (priority > t->priority)
+    thread_set_effective_priority(t, priority);
 }
 
-/* Returns the current thread's nice value. */
-int thread_get_nice(void) {
-  /* Not yet implemented. */
-  return 0;
+/* Recomputes T's effective priority from its base priority and
+   the threads waiting on locks it holds, as after T releases a
+   lock or changes its base priority.  Only the strict priority
+   scheduler donates, so under the others T's base priority is
+   its effective priority.  Interrupts must be off. */
+void thread_refresh_priority(struct thread* t) {
+  int priority = t->base_priority;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (active_sched_policy != SCHED_PRIO) {
+    thread_set_effective_priority(t, priority);
+    return;
+  }
+  for (struct list_elem* e = list_begin(&t->locks_held); e != list_end(&t->locks_held);
+       e = list_next(e)) {
+    struct list* waiters = &list_entry(e, struct lock, elem)->semaphore.waiters;
+    for (struct list_elem* w = list_begin(waiters); w != list_end(waiters); w = list_next(w)) {
+      int donated = list_entry(w, struct thread, elem)->priority;
+      if (donated > priority)
+        priority = donated;
+    }
+  }
+  thread_set_effective_priority(t, priority);
 }
 
-/* Returns 100 times the system load average. */
-int thread_get_load_avg(void) {
-  /* Not yet implemented. */
-  return 0;
+/* Yields the CPU if a ready thread has a higher priority than the
+   running one under the strict priority scheduler or the MLFQS.
+   In an interrupt handler the yield happens on return.  A caller
+   that turned interrupts off may be counting on not being
+   preempted, so it is left running. */
+void thread_preempt(void) {
+  enum intr_level old_level;
+
+  if (!prio_queued())
+    return;
+
+  old_level = intr_disable();
+  if (prio_highest_ready() > thread_current()->priority) {
+    if (intr_context())
+      intr_yield_on_return();
+    else if (old_level == INTR_ON)
+      thread_yield();
+  }
+  intr_set_level(old_level);
 }
 
-/* Returns 100 times the current thread's recent_cpu value. */
-int thread_get_recent_cpu(void) {
-  /* Not yet implemented. */
-  return 0;
+/* Recomputes T's MLFQS priority from its recent_cpu and nice
+   values.  Interrupts must be off. */
+static void mlfqs_update_priority(struct thread* t) {
+  fixed_point_t usage = fix_unscale(t->recent_cpu, 4);
+  int priority = fix_trunc(fix_sub(fix_int(PRI_MAX - t->nice * 2), usage));
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (t == idle_thread)
+    return;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->base_priority = priority;
+  thread_set_effective_priority(t, priority);
+}
+
+/* Decays T's recent_cpu by the factor at DECAY_ and recomputes
+   its priority.  Called by thread_foreach() once a second. */
+static void mlfqs_decay(struct thread* t, void* decay_) {
+  fixed_point_t* decay = decay_;
+
+  if (t == idle_thread)
+    return;
+  t->recent_cpu = fix_add(fix_mul(*decay, t->recent_cpu), fix_int(t->nice));
+  mlfqs_update_priority(t);
 }
 
+/* Does the MLFQS bookkeeping for a timer tick during which T was
+   running.  Runs in an external interrupt context. */
+static void mlfqs_tick(struct thread* t) {
+  int64_t ticks = timer_ticks();
+
+  if (t != idle_thread)
+    t->recent_cpu = fix_add(t->recent_cpu, fix_int(1));
+
+  if (ticks % TIMER_FREQ == 0) {
+    int ready = prio_ready_cnt + (t != idle_thread);
+    fixed_point_t twice_load;
+    fixed_point_t decay;
+
+    load_avg = fix_add(fix_mul(fix_frac(59, 60), load_avg), fix_scale(fix_frac(1, 60), ready));
+    twice_load = fix_scale(load_avg, 2);
+    decay = fix_div(twice_load, fix_add(twice_load, fix_int(1)));
+    thread_foreach(mlfqs_decay, &decay);
+  } else if (ticks % MLFQS_PRI_TICKS == 0)
+    mlfqs_update_priority(t);
+
+  thread_preempt();
+}
+
+/* Sets the current thread's nice value to NICE and recomputes its
+   priority, yielding if it no longer has the highest priority. */
+void thread_set_nice(int nice) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+
+  ASSERT(NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable();
+  cur->nice = nice;
+  if (active_sched_policy == SCHED_MLFQS)
+    mlfqs_update_priority(cur);
+  intr_set_level(old_level);
+  thread_preempt();
+}
+
+/* Returns the current thread's nice value. */
+int thread_get_nice(void) { return thread_current()->nice; }
+
+/* Returns 100 times the system load average. */
+int thread_get_load_avg(void) { return fix_round(fix_scale(load_avg, 100)); }
+
+/* Returns 100 times the current thread's recent_cpu value. */
+int thread_get_recent_cpu(void) { return fix_round(fix_scale(thread_current()->recent_cpu, 100)); }
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -400,6 +740,10 @@ static void idle(void* idle_started_ UNUSED) {
     intr_disable();
     thread_block();
 
+    /* Nothing else is ready, so let the timer sleep until the
+       next thread is due to wake up. */
+    timer_idle();
+
     /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -454,11 +798,17 @@ static void init_thread(struct thread* t, const char* name, int priority) {
   strlcpy(t->name, name, sizeof t->name);
   t->stack = (uint8_t*)t + PGSIZE;
   t->priority = priority;
+  t->base_priority = priority;
+  t->nice = 0;
+  t->recent_cpu = fix_int(0);
+  list_init(&t->locks_held);
+  t->waiting_lock = NULL;
   t->pcb = NULL;
   t->magic = THREAD_MAGIC;
 
   old_level = intr_disable();
   list_push_back(&all_list, &t->allelem);
+  all_cnt++;
   intr_set_level(old_level);
 }
 
@@ -481,21 +831,41 @@ static struct thread* thread_schedule_fifo(void) {
     return idle_thread;
 }
 
-/* Strict priority scheduler */
+/* Strict priority scheduler, round-robin within a priority */
 static struct thread* thread_schedule_prio(void) {
-  PANIC("Unimplemented scheduler policy: \"-sched=prio\"");
+  int priority = prio_highest_ready();
+  struct thread* t;
+
+  if (priority < 0)
+    return idle_thread;
+
+  t = list_entry(list_pop_front(&prio_ready_lists[priority]), struct thread, elem);
+  if (list_empty(&prio_ready_lists[priority]))
+    prio_ready_mask &= ~((uint64_t)1 << priority);
+  prio_ready_cnt--;
+  return t;
 }
 
-/* Fair priority scheduler */
+/* Fair scheduler: runs the ready thread that is furthest behind
+   in virtual runtime. */
 static struct thread* thread_schedule_fair(void) {
-  PANIC("Unimplemented scheduler policy: \"-sched=fair\"");
-}
+  struct thread* t;
+
+  if (fair_heap_cnt == 0)
+    return idle_thread;
 
-/* Multi-level feedback queue scheduler */
-static struct thread* thread_schedule_mlfqs(void) {
-  PANIC("Unimplemented scheduler policy: \"-sched=mlfqs\"");
+  t = fair_heap[0];
+  fair_heap_remove(0);
+  if (t->vruntime > fair_min_vruntime)
+    fair_min_vruntime = t->vruntime;
+  return t;
 }
 
+/* Multi-level feedback queue scheduler.  The queues are the
+   strict priority scheduler's; only the way priorities are set
+   differs. */
+static struct thread* thread_schedule_mlfqs(void) { return thread_schedule_prio(); }
+
 /* Not an actual scheduling policy — placeholder for empty
  * slots in the scheduler jump table. */
 static struct thread* thread_schedule_reserved(void) {
@@ -538,6 +908,9 @@ void thread_switch_tail(struct thread* prev) {
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Trap the first FPU instruction unless the FPU holds our state. */
+  fpu_switch(cur);
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate();
@@ -550,6 +923,7 @@ void thread_switch_tail(struct thread* prev) {
      palloc().) */
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) {
     ASSERT(prev != cur);
+    fpu_release(prev);
     palloc_free_page(prev);
   }
 }
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/fixed-point.h"
 
@@ -15,13 +16,6 @@ enum thread_status {
   THREAD_DYING    /* About to be destroyed. */
 };
 
-// Node used in efficient alarm clock list
-typedef struct WakeListNode {
-  int64_t timestamp; // Timestamp at which to wake threads
-  struct thread* t;  // Thread
-  struct list_elem elem;
-} wake_node;
-
 /* Thread identifier type.
    You can redefine this to whatever type you like. */
 typedef int tid_t;
@@ -94,15 +88,34 @@ struct thread {
   enum thread_status status; /* Thread state. */
   char name[16];             /* Name (for debugging purposes). */
   uint8_t* stack;            /* Saved stack pointer. */
-  int priority;              /* Priority. */
+  int priority;              /* Effective priority, including donations. */
+  int base_priority;         /* Priority before donation. */
   struct list_elem allelem;  /* List element for all threads list. */
+  int64_t vruntime;          /* Weighted CPU time, for the fair scheduler. */
+  size_t fair_idx;           /* Index in the fair scheduler's heap while ready. */
+  int nice;                  /* Niceness, for the MLFQS. */
+  fixed_point_t recent_cpu;  /* Recent CPU time used, for the MLFQS. */
+
+  /* Owned by synch.c, for priority donation. */
+  struct list locks_held;    /* Locks this thread holds. */
+  struct lock* waiting_lock; /* Lock this thread is waiting for, or NULL. */
 
   /* Shared between thread.c and synch.c. */
   struct list_elem elem; /* List element. */
 
+  /* Owned by threads/interrupt.c. */
+  uint8_t fpu[FPU_SIZE]; /* FPU state while another thread holds the FPU. */
+  bool fpu_used;         /* Has used the FPU. */
+
+  /* Owned by devices/timer.c. */
+  int64_t wake_time;          /* Tick to wake up at from timer_sleep(). */
+  struct list_elem wake_elem; /* Element in a timer wheel slot. */
+
 #ifdef USERPROG
   /* Owned by process.c. */
-  struct process* pcb; /* Process control block if this thread is a userprog */
+  struct process* pcb;         /* Process control block if this thread is a userprog */
+  void* user_esp;              /* User stack pointer on entry to the kernel. */
+  struct user_thread* uthread; /* Join record, or NULL once joiners are woken. */
 #endif
 
   /* Owned by thread.c. */
@@ -125,8 +138,6 @@ enum sched_policy {
  * Is equal to SCHED_FIFO by default. */
 extern enum sched_policy active_sched_policy;
 
-struct list* get_wake_list();
-
 void thread_init(void);
 void thread_start(void);
 
@@ -152,6 +163,9 @@ void thread_foreach(thread_action_func*, void*);
 
 int thread_get_priority(void);
 void thread_set_priority(int);
+void thread_donate_priority(struct thread*, int priority);
+void thread_refresh_priority(struct thread*);
+void thread_preempt(void);
 
 int thread_get_nice(void);
 void thread_set_nice(int);
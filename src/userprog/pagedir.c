@@ -145,6 +145,14 @@ bool pagedir_is_dirty(uint32_t* pd, const void* vpage) {
   return pte != NULL && (*pte & PTE_D) != 0;
 }
 
+/* Returns true if the PTE for virtual page VPAGE in PD is
+   present and writable.
+   Returns false if PD contains no PTE for VPAGE. */
+bool pagedir_is_writable(uint32_t* pd, const void* vpage) {
+  uint32_t* pte = lookup_page(pd, vpage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
+}
+
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
    in PD. */
 void pagedir_set_dirty(uint32_t* pd, const void* vpage, bool dirty) {
@@ -16,15 +16,33 @@
 #include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static struct semaphore temporary;
+
+/* Caches of process control blocks, the metadata they share with
+   their parents, and parents' child list nodes. */
+static struct kmem_cache* process_cache;
+static struct kmem_cache* metadata_cache;
+static struct kmem_cache* child_cache;
+
 static thread_func start_process NO_RETURN;
 static thread_func start_pthread NO_RETURN;
 static bool load(const char* file_name, void (**eip)(void), void** esp);
-bool setup_thread(void (**eip)(void), void** esp);
+static bool setup_thread(int slot, stub_fun, pthread_fun, void* arg, void (**eip)(void),
+                         void** esp);
+static void threads_init(struct process*);
+static bool user_thread_add(struct process*, struct thread*, int slot);
+static void user_threads_destroy(struct process*);
+static void wake_joiners(struct thread*);
+static void thread_die(struct process*) NO_RETURN;
 struct pcb_metadata* init_metadata(int ref_num);
 
 /* Initializes user programs in the system by ensuring the main
@@ -35,31 +53,35 @@ void userprog_init(void) { // NOTE: might need to give fd table + child list
   struct thread* t = thread_current();
   bool success;
 
+  /* User threads find their stack slots by this, see
+     USER_STACK_SLOT_SIZE. */
+  ASSERT((uintptr_t)PHYS_BASE % USER_STACK_SLOT_SIZE == 0);
+
+  process_cache = kmem_cache_create("process", sizeof(struct process), NULL);
+  metadata_cache = kmem_cache_create("pcb_metadata", sizeof(struct pcb_metadata), NULL);
+  child_cache = kmem_cache_create("child_node", sizeof(struct child_node), NULL);
+  if (process_cache == NULL || metadata_cache == NULL || child_cache == NULL)
+    PANIC("process cache allocation failed");
+
   /* Allocate process control block
-     It is imoprtant that this is a call to calloc and not malloc,
-     so that t->pcb->pagedir is guaranteed to be NULL (the kernel's
-     page directory) when t->pcb is assigned, because a timer interrupt
-     can come at any time and activate our pagedir */
-  t->pcb = calloc(sizeof(struct process), 1);
+     It is imoprtant that this is zeroed, so that t->pcb->pagedir
+     is guaranteed to be NULL (the kernel's page directory) when
+     t->pcb is assigned, because a timer interrupt can come at any
+     time and activate our pagedir */
+  t->pcb = kmem_cache_zalloc(process_cache);
   success = t->pcb != NULL;
 
-  /* Initialize fd_list with stdin, stdout & set metadata*/
+  /* Set metadata; the fd table is allocated on the first open */
   if (success) {
     struct pcb_metadata* data = init_metadata(1);
     t->pcb->my_data = data;
     list_init(&t->pcb->child_list);
-    list_init(&t->pcb->fd_list);
-    for (int i = 0; i < 2; i++) { //CONSIDER TAKING THIS OUT
-      fd_node* node = malloc(sizeof(fd_node));
-      if (node == NULL) {
-        success = false;
-        break;
-      }
-      node->fdIndex = i;
-      node->file = node->dir = NULL;
-      list_push_back(&t->pcb->fd_list, &node->elem);
-    }
-    t->pcb->next_fd = 2;
+    t->pcb->fd_low = FD_FIRST;
+    threads_init(t->pcb);
+#ifdef VM
+    page_table_init(t->pcb);
+    mmap_init(t->pcb);
+#endif
   }
 
   /* Kill the kernel if we did not succeed */
@@ -70,7 +92,7 @@ void userprog_init(void) { // NOTE: might need to give fd table + child list
    locks, semaphores, initial process state
    and reference number. */
 struct pcb_metadata* init_metadata(int ref_num) { // sets up a metadata struct
-  struct pcb_metadata* metadata = malloc(sizeof(struct pcb_metadata));
+  struct pcb_metadata* metadata = kmem_cache_alloc(metadata_cache);
   sema_init(&metadata->exec_sema, 0); //THESE MIGHT BE INITIALIZED TO ONE NOT ZERO;
   sema_init(&metadata->wait_sema, 0);
   lock_init(&metadata->edit_lock);
@@ -100,7 +122,7 @@ pid_t exec(const char* cmd_line) {
   tid = thread_create(cmd_line, PRI_DEFAULT, start_process, to_pass); // pass data
   if (tid == TID_ERROR)
     palloc_free_page(fn_copy);
-  struct child_node* new_child = malloc(sizeof(struct child_node)); // add child to list
+  struct child_node* new_child = kmem_cache_alloc(child_cache); // add child to list
   new_child->child_data = child_data;
   new_child->child_pid = tid;
   new_child->waited = false;
@@ -137,7 +159,7 @@ pid_t process_execute(const char* file_name) {
   tid = thread_create(file_name, PRI_DEFAULT, start_process, to_pass);
   if (tid == TID_ERROR)
     palloc_free_page(fn_copy);
-  struct child_node* new_child = malloc(sizeof(struct child_node)); // add child to list
+  struct child_node* new_child = kmem_cache_alloc(child_cache); // add child to list
   new_child->child_data = child_data;
   new_child->child_pid = tid;
   new_child->waited = false;
@@ -158,7 +180,7 @@ static void start_process(void* package) {
   free(passed);
 
   /* Allocate process control block */
-  struct process* new_pcb = malloc(sizeof(struct process));
+  struct process* new_pcb = kmem_cache_alloc(process_cache);
   success = pcb_success = new_pcb != NULL;
 
   /* Initialize process control block */
@@ -171,6 +193,15 @@ static void start_process(void* package) {
     // Continue initializing the PCB as normal
     t->pcb->main_thread = t;
     t->pcb->my_data = my_data;
+    t->pcb->fd_table = NULL;
+    t->pcb->fd_cap = 0;
+    t->pcb->fd_low = FD_FIRST;
+    threads_init(t->pcb);
+#ifdef VM
+    page_table_init(t->pcb);
+    mmap_init(t->pcb);
+#endif
+    success = user_thread_add(t->pcb, t, 0);
     t->pcb->cwd = cwd == NULL ? dir_open_root() : dir_reopen(cwd);
     size_t f_space = 1;
     for (int i = 0; i < (int)strlen(t->name); i++) {
@@ -186,12 +217,6 @@ static void start_process(void* package) {
 
   if (success) {
     memset(&if_, 0, sizeof if_);
-    //try this for sasving fpu on start process
-    char temp_fpu[108];
-    asm("fsave (%0); fninit; fsave (%1); frstor (%2)"
-        :
-        : "g"(&temp_fpu), "g"(if_.fpu), "g"(&temp_fpu));
-    //end
     if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
     if_.cs = SEL_UCSEG;
     if_.eflags = FLAG_IF | FLAG_MBS;
@@ -220,7 +245,7 @@ static void start_process(void* package) {
           t->pcb->my_data->procstate = LOADFAIL;
           t->pcb->my_data->ref_num--;
           if (t->pcb->my_data->ref_num == 0) {
-            free(my_data);
+            kmem_cache_free(metadata_cache, my_data);
           } else {
             lock_release(&t->pcb->my_data->edit_lock);
             sema_up(&t->pcb->my_data->exec_sema); // wake up a potential waiter from exec
@@ -255,8 +280,6 @@ static void start_process(void* package) {
     memcpy(if_.esp, &argc, 4);
 
     list_init(&thread_current()->pcb->child_list);
-    list_init(&thread_current()->pcb->fd_list);
-    thread_current()->pcb->next_fd = 2;
   }
 load_fail_exit:
   /* Handle failure with succesful PCB malloc. Must free the PCB */
@@ -266,7 +289,11 @@ load_fail_exit:
     // can try to activate the pagedir, but it is now freed memory
     struct process* pcb_to_free = t->pcb;
     t->pcb = NULL;
-    free(pcb_to_free);
+    user_threads_destroy(pcb_to_free);
+#ifdef VM
+    page_table_destroy(pcb_to_free);
+#endif
+    kmem_cache_free(process_cache, pcb_to_free);
   }
 
   /* Clean up. Exit on failure or jump to userspace */
@@ -323,13 +350,41 @@ int process_wait(pid_t child_pid UNUSED) {
 /* Free the current process's resources. */
 void process_exit(int status) {
   struct thread* cur = thread_current();
+  struct process* p = cur->pcb;
   uint32_t* pd;
 
   /* If this thread does not have a PCB, don't worry */
-  if (cur->pcb == NULL) {
+  if (p == NULL) {
     thread_exit();
     NOT_REACHED();
   }
+
+  /* Only the first thread to exit the process tears it down.  The
+     other threads share everything freed below, so it waits for
+     them to notice the process is exiting and die first. */
+  lock_acquire(&p->thread_lock);
+  if (p->exiting) {
+    lock_release(&p->thread_lock);
+    pthread_exit();
+    NOT_REACHED();
+  }
+  p->exiting = true;
+  wake_joiners(cur);
+  cond_broadcast(&p->thread_exited, &p->thread_lock);
+  usersync_wake_all(p);
+  while (p->live_threads > 1)
+    cond_wait(&p->thread_exited, &p->thread_lock);
+  lock_release(&p->thread_lock);
+
+#ifdef VM
+  /* Write back mapped files and release frames and swap slots
+     while the page directory still maps them. */
+  mmap_destroy(cur->pcb);
+  page_table_destroy(cur->pcb);
+#endif
+
+  /* Close the executable only after its pages are gone, since
+     they are read from it and shared by its inode. */
   struct file* file = cur->pcb->executable;
   file_allow_write(file);
   file_close(file);
@@ -360,7 +415,7 @@ void process_exit(int status) {
   pcb_to_free->my_data->exit_status = status;
   pcb_to_free->my_data->ref_num--;
   if (pcb_to_free->my_data->ref_num == 0) {               // free if shared data if needed
-    free(pcb_to_free->my_data);                           // need to add
+    kmem_cache_free(metadata_cache, pcb_to_free->my_data); // need to add
   } else if (pcb_to_free->my_data->procstate != KILLED) { // update status
     pcb_to_free->my_data->procstate = EXITED;
     sema_up(&pcb_to_free->my_data->wait_sema);
@@ -369,15 +424,7 @@ void process_exit(int status) {
     lock_release(&pcb_to_free->my_data->edit_lock);
   }
 
-  for (struct list_elem* e; !list_empty(&pcb_to_free->fd_list);) {
-    e = list_pop_front(&pcb_to_free->fd_list);
-    fd_node* node = list_entry(e, fd_node, elem);
-    if (node->file)
-      file_close(node->file);
-    else if (node->dir)
-      dir_close(node->dir);
-    free(node);
-  }
+  fd_close_all(pcb_to_free);
 
   for (struct list_elem* e; !list_empty(&pcb_to_free->child_list);) {
     e = list_pop_front(&pcb_to_free->child_list);
@@ -385,14 +432,16 @@ void process_exit(int status) {
     lock_acquire(&node->child_data->edit_lock);
     node->child_data->ref_num--;
     if (&node->child_data->ref_num == 0) {
-      free(&node->child_data); //CHANGE
+      kmem_cache_free(metadata_cache, node->child_data); //CHANGE
     } else {
       lock_release(&node->child_data->edit_lock);
     }
-    free(node);
+    kmem_cache_free(child_cache, node);
   }
 
-  free(pcb_to_free);
+  user_threads_destroy(pcb_to_free);
+  usersync_destroy(pcb_to_free);
+  kmem_cache_free(process_cache, pcb_to_free);
   sema_up(&temporary);
   thread_exit();
 }
@@ -582,7 +631,9 @@ done:
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page(void* upage, void* kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -647,6 +698,23 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage, uint32_t
   ASSERT(pg_ofs(upage) == 0);
   ASSERT(ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Record each page and let page_fault_in() read it on first
+     touch. */
+  while (read_bytes > 0 || zero_bytes > 0) {
+    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+    size_t page_zero_bytes = PGSIZE - page_read_bytes;
+
+    if (!page_add_file(file, ofs, upage, page_read_bytes, writable))
+      return false;
+
+    read_bytes -= page_read_bytes;
+    zero_bytes -= page_zero_bytes;
+    ofs += page_read_bytes;
+    upage += PGSIZE;
+  }
+  return true;
+#else
   file_seek(file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) {
     /* Calculate how to fill this page.
@@ -679,11 +747,22 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage, uint32_t
     upage += PGSIZE;
   }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
    user virtual memory. */
 static bool setup_stack(void** esp) {
+#ifdef VM
+  /* Only the top page is brought in now, since the arguments are
+     about to be pushed onto it.  The rest of the stack grows on
+     demand, see vm/page.c. */
+  uint8_t* upage = ((uint8_t*)PHYS_BASE) - PGSIZE;
+  if (!page_add_zero(upage, true) || !page_fault_in(upage, true, NULL))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t* kpage;
   bool success = false;
 
@@ -696,8 +775,10 @@ static bool setup_stack(void** esp) {
       palloc_free_page(kpage);
   }
   return success;
+#endif
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -715,6 +796,7 @@ static bool install_page(void* upage, void* kpage, bool writable) {
   return (pagedir_get_page(t->pcb->pagedir, upage) == NULL &&
           pagedir_set_page(t->pcb->pagedir, upage, kpage, writable));
 }
+#endif
 
 /* Returns true if t is the main thread of the process p */
 bool is_main_thread(struct thread* t, struct process* p) { return p->main_thread == t; }
@@ -722,64 +804,418 @@ bool is_main_thread(struct thread* t, struct process* p) { return p->main_thread
 /* Gets the PID of a process */
 pid_t get_pid(struct process* p) { return (pid_t)p->main_thread->tid; }
 
-/* Creates a new stack for the thread and sets up its arguments.
-   Stores the thread's entry point into *EIP and its initial stack
-   pointer into *ESP. Handles all cleanup if unsuccessful. Returns
-   true if successful, false otherwise.
+/* Returns the top of the user stack in SLOT.  Each stack may grow
+   down to MAX_STACK_PAGES below its top, and slot 0, just below
+   PHYS_BASE, is the main thread's. */
+static uint8_t* stack_top(int slot) {
+  return (uint8_t*)PHYS_BASE - slot * MAX_STACK_PAGES * PGSIZE;
+}
+
+/* Returns true if UADDR is in the current thread's user stack
+   slot, the only range its stack may grow into. */
+bool user_stack_contains(const void* uaddr) {
+  struct thread* t = thread_current();
+  const uint8_t* addr = uaddr;
+  uint8_t* top;
+
+  if (t->uthread == NULL)
+    return false;
+  top = stack_top(t->uthread->slot);
+  return addr < top && addr >= top - MAX_STACK_PAGES * PGSIZE;
+}
+
+/* Frees the user stack in SLOT of P, which must be P's page
+   directory. */
+static void free_stack(struct process* p UNUSED, int slot) {
+  uint8_t* top = stack_top(slot);
+#ifdef VM
+  for (uint8_t* upage = top - MAX_STACK_PAGES * PGSIZE; upage < top; upage += PGSIZE)
+    page_remove(upage);
+#else
+  void* kpage = pagedir_get_page(p->pagedir, top - PGSIZE);
+  if (kpage != NULL) {
+    pagedir_clear_page(p->pagedir, top - PGSIZE);
+    palloc_free_page(kpage);
+  }
+#endif
+}
+
+/* Initializes the thread bookkeeping and user synchronization
+   objects of P, which has no threads yet. */
+static void threads_init(struct process* p) {
+  lock_init(&p->fd_lock);
+  list_init(&p->threads);
+  lock_init(&p->thread_lock);
+  cond_init(&p->thread_exited);
+  p->live_threads = 0;
+  p->exiting = false;
+  memset(p->stack_used, 0, sizeof p->stack_used);
+  usersync_init(p);
+}
+
+/* Creates the join record for T, which runs on the user stack in
+   SLOT, and counts T as a live thread of P.  Must be called with
+   P's thread_lock held, unless T is P's first thread.  Returns
+   false if memory is short. */
+static bool user_thread_add(struct process* p, struct thread* t, int slot) {
+  struct user_thread* ut = malloc(sizeof *ut);
+  if (ut == NULL)
+    return false;
+
+  ut->tid = t->tid;
+  ut->slot = slot;
+  ut->joined = false;
+  sema_init(&ut->done, 0);
+  list_push_back(&p->threads, &ut->elem);
+  p->stack_used[slot] = true;
+  p->live_threads++;
+  t->uthread = ut;
+  return true;
+}
+
+/* Frees the join records left in P. */
+static void user_threads_destroy(struct process* p) {
+  while (!list_empty(&p->threads))
+    free(list_entry(list_pop_front(&p->threads), struct user_thread, elem));
+}
+
+/* Wakes any thread joining T.  Once this is done a joiner may free
+   T's record at any time, so T drops it. */
+static void wake_joiners(struct thread* t) {
+  if (t->uthread != NULL) {
+    sema_up(&t->uthread->done);
+    t->uthread = NULL;
+  }
+}
+
+/* Kills the current thread, a live thread of P, and wakes a thread
+   exiting the process if it was the last other thread.  Must be
+   called with P's thread_lock held.  Once the lock is released P
+   may be freed at any time, so interrupts stay off from there
+   until the thread is gone. */
+static void thread_die(struct process* p) {
+  struct thread* cur = thread_current();
+
+  p->live_threads--;
+  cond_broadcast(&p->thread_exited, &p->thread_lock);
+  intr_disable();
+  lock_release(&p->thread_lock);
+  cur->pcb = NULL;
+  thread_exit();
+}
 
-   This function will be implemented in Project 2: Multithreading. For
-   now, it does nothing. You may find it necessary to change the
-   function signature. */
-bool setup_thread(void (**eip)(void) UNUSED, void** esp UNUSED) { return false; }
+/* Makes a user stack in SLOT that calls SF (TF, ARG), as though
+   from a function with a null return address.  Stores the thread's
+   entry point into *EIP and its initial stack pointer into *ESP.
+   Returns true if successful, false otherwise, in which case the
+   caller frees the stack. */
+static bool setup_thread(int slot, stub_fun sf, pthread_fun tf, void* arg, void (**eip)(void),
+                         void** esp) {
+  uint8_t* top = stack_top(slot);
+  uint32_t* sp;
+
+#ifdef VM
+  if (!page_add_zero(top - PGSIZE, true) || !page_fault_in(top - PGSIZE, true, NULL))
+    return false;
+#else
+  uint8_t* kpage = palloc_get_page(PAL_USER | PAL_ZERO);
+  if (kpage == NULL)
+    return false;
+  if (!install_page(top - PGSIZE, kpage, true)) {
+    palloc_free_page(kpage);
+    return false;
+  }
+#endif
+
+  /* Leave esp + 4 16-byte aligned, as at any function entry. */
+  sp = (uint32_t*)(top - 20);
+  sp[0] = 0;
+  sp[1] = (uint32_t)tf;
+  sp[2] = (uint32_t)arg;
+  *eip = (void (*)(void))sf;
+  *esp = sp;
+  return true;
+}
+
+/* Passed from pthread_execute() to start_pthread(). */
+struct pthread_pack {
+  stub_fun sf;
+  pthread_fun tf;
+  void* arg;
+  struct process* pcb;
+  struct semaphore started; /* Upped once the thread has started or failed. */
+  bool success;
+};
 
 /* Starts a new thread with a new user stack running SF, which takes
    TF and ARG as arguments on its user stack. This new thread may be
    scheduled (and may even exit) before pthread_execute () returns.
    Returns the new thread's TID or TID_ERROR if the thread cannot
-   be created properly.
+   be created properly. */
+tid_t pthread_execute(stub_fun sf, pthread_fun tf, void* arg) {
+  struct process* p = thread_current()->pcb;
+  struct pthread_pack pack;
+  tid_t tid;
+
+  pack.sf = sf;
+  pack.tf = tf;
+  pack.arg = arg;
+  pack.pcb = p;
+  sema_init(&pack.started, 0);
+  pack.success = false;
+
+  tid = thread_create(p->process_name, PRI_DEFAULT, start_pthread, &pack);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+  sema_down(&pack.started);
+  return pack.success ? tid : TID_ERROR;
+}
 
-   This function will be implemented in Project 2: Multithreading and
-   should be similar to process_execute (). For now, it does nothing.
-   */
-tid_t pthread_execute(stub_fun sf UNUSED, pthread_fun tf UNUSED, void* arg UNUSED) { return -1; }
+/* A thread function that joins the process in PACK_, claiming a
+   free stack slot, and starts running user code. */
+static void start_pthread(void* pack_) {
+  struct pthread_pack* pack = pack_;
+  struct process* p = pack->pcb;
+  struct thread* t = thread_current();
+  struct intr_frame if_;
+  int slot;
+
+  t->pcb = p;
+  process_activate();
+
+  /* Take a stack slot.  From here on the thread counts as live, so
+     the process cannot be torn down under it. */
+  lock_acquire(&p->thread_lock);
+  for (slot = 1; slot < MAX_THREADS && p->stack_used[slot]; slot++)
+    continue;
+  if (p->exiting || slot == MAX_THREADS || !user_thread_add(p, t, slot)) {
+    intr_disable();
+    lock_release(&p->thread_lock);
+    t->pcb = NULL;
+    sema_up(&pack->started);
+    thread_exit();
+  }
+  lock_release(&p->thread_lock);
+
+  memset(&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+
+  if (!setup_thread(slot, pack->sf, pack->tf, pack->arg, &if_.eip, &if_.esp)) {
+    free_stack(p, slot);
+    lock_acquire(&p->thread_lock);
+    list_remove(&t->uthread->elem);
+    free(t->uthread);
+    t->uthread = NULL;
+    p->stack_used[slot] = false;
+    sema_up(&pack->started);
+    thread_die(p);
+  }
 
-/* A thread function that creates a new user thread and starts it
-   running. Responsible for adding itself to the list of threads in
-   the PCB.
+  /* PACK is gone once the creator wakes up. */
+  pack->success = true;
+  sema_up(&pack->started);
 
-   This function will be implemented in Project 2: Multithreading and
-   should be similar to start_process (). For now, it does nothing. */
-static void start_pthread(void* exec_ UNUSED) {}
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
 
 /* Waits for thread with TID to die, if that thread was spawned
    in the same process and has not been waited on yet. Returns TID on
    success and returns TID_ERROR on failure immediately, without
-   waiting.
+   waiting. */
+tid_t pthread_join(tid_t tid) {
+  struct thread* cur = thread_current();
+  struct process* p = cur->pcb;
+  struct user_thread* target = NULL;
+
+  lock_acquire(&p->thread_lock);
+  for (struct list_elem* e = list_begin(&p->threads); e != list_end(&p->threads);
+       e = list_next(e)) {
+    struct user_thread* ut = list_entry(e, struct user_thread, elem);
+    if (ut->tid == tid) {
+      target = ut;
+      break;
+    }
+  }
+  if (target == NULL || target->joined || tid == cur->tid) {
+    lock_release(&p->thread_lock);
+    return TID_ERROR;
+  }
+  target->joined = true;
+  lock_release(&p->thread_lock);
 
-   This function will be implemented in Project 2: Multithreading. For
-   now, it does nothing. */
-tid_t pthread_join(tid_t tid UNUSED) { return -1; }
+  sema_down(&target->done);
 
-/* Free the current thread's resources. Most resources will
-   be freed on thread_exit(), so all we have to do is deallocate the
-   thread's userspace stack. Wake any waiters on this thread.
+  lock_acquire(&p->thread_lock);
+  list_remove(&target->elem);
+  lock_release(&p->thread_lock);
+  free(target);
+  return tid;
+}
 
-   The main thread should not use this function. See
-   pthread_exit_main() below.
+/* Frees the current thread's userspace stack, wakes any thread
+   joining it and kills it.  The rest of the thread is freed by
+   thread_exit().
 
-   This function will be implemented in Project 2: Multithreading. For
-   now, it does nothing. */
-void pthread_exit(void) {}
+   The main thread uses this only when the process is exiting
+   underneath it; otherwise see pthread_exit_main() below. */
+void pthread_exit(void) {
+  struct thread* cur = thread_current();
+  struct process* p = cur->pcb;
+  int slot = cur->uthread != NULL ? cur->uthread->slot : 0;
+
+  /* The main thread's stack goes with the process. */
+  if (slot != 0)
+    free_stack(p, slot);
+
+  lock_acquire(&p->thread_lock);
+  if (slot != 0)
+    p->stack_used[slot] = false;
+  wake_joiners(cur);
+  thread_die(p);
+}
 
 /* Only to be used when the main thread explicitly calls pthread_exit.
-   The main thread should wait on all threads in the process to
-   terminate properly, before exiting itself. When it exits itself, it
-   must terminate the process in addition to all necessary duties in
-   pthread_exit.
-
-   This function will be implemented in Project 2: Multithreading. For
-   now, it does nothing. */
-void pthread_exit_main(void) {}
+   The main thread waits on all threads in the process to
+   terminate, then exits the process with status 0.  If another
+   thread exits the process first, it just dies. */
+void pthread_exit_main(void) {
+  struct thread* cur = thread_current();
+  struct process* p = cur->pcb;
+  bool killed;
+
+  lock_acquire(&p->thread_lock);
+  wake_joiners(cur);
+  while (p->live_threads > 1 && !p->exiting)
+    cond_wait(&p->thread_exited, &p->thread_lock);
+  killed = p->exiting;
+  lock_release(&p->thread_lock);
+
+  if (killed) {
+    pthread_exit();
+    NOT_REACHED();
+  }
+  printf("%s: exit(%d)\n", p->process_name, 0);
+  process_exit(0);
+}
+
+/* Kills the current thread if another thread of its process is
+   exiting the process.  Called wherever a thread is about to
+   return to user mode, including from interrupts, since a thread
+   running user code may never enter the kernel on its own. */
+void pthread_exit_if_killed(void) {
+  struct process* p = thread_current()->pcb;
+
+  if (p != NULL && p->exiting) {
+    intr_enable();
+    pthread_exit();
+  }
+}
+
+/* Installs FILE or DIR in the lowest free fd of P, growing the
+   table if every slot is taken. Returns the fd, or -1 if the table
+   could not be grown. */
+int fd_alloc(struct process* p, struct file* file, struct dir* dir) {
+  int fd;
+
+  ASSERT(file != NULL || dir != NULL);
+
+  lock_acquire(&p->fd_lock);
+  for (fd = p->fd_low; fd < p->fd_cap; fd++)
+    if (p->fd_table[fd].file == NULL && p->fd_table[fd].dir == NULL)
+      break;
+
+  /* FD_LOW may lie past the end of the table, as it does before
+     the first open, so grow it to cover FD. */
+  if (fd >= p->fd_cap) {
+    int new_cap = p->fd_cap == 0 ? FD_TABLE_MIN : p->fd_cap * 2;
+    if (new_cap < fd + 1)
+      new_cap = fd + 1;
+    fd_node* new_table = realloc(p->fd_table, new_cap * sizeof *new_table);
+    if (new_table == NULL) {
+      lock_release(&p->fd_lock);
+      return -1;
+    }
+    memset(new_table + p->fd_cap, 0, (new_cap - p->fd_cap) * sizeof *new_table);
+    p->fd_table = new_table;
+    p->fd_cap = new_cap;
+  }
+
+  p->fd_table[fd].file = file;
+  p->fd_table[fd].dir = dir;
+  p->fd_low = fd + 1;
+  lock_release(&p->fd_lock);
+  return fd;
+}
+
+/* Returns the open slot for FD in P, or NULL if FD is not open.
+   The console fds have no slot.  The caller must hold P's fd_lock
+   until it is done with the slot and the file or directory in it,
+   since another thread may otherwise grow the table or close the
+   fd underneath it. */
+fd_node* fd_lookup(struct process* p, int fd) {
+  ASSERT(lock_held_by_current_thread(&p->fd_lock));
+
+  if (fd < FD_FIRST || fd >= p->fd_cap)
+    return NULL;
+  fd_node* node = &p->fd_table[fd];
+  return node->file != NULL || node->dir != NULL ? node : NULL;
+}
+
+/* Returns the file open as FD in P with a reference added, or a
+   null pointer if FD is not an open file.  The caller drops the
+   reference with file_close() and need not hold P's fd_lock while
+   it uses the file, which stays open even if FD is closed. */
+struct file* fd_file(struct process* p, int fd) {
+  struct file* file = NULL;
+
+  lock_acquire(&p->fd_lock);
+  fd_node* node = fd_lookup(p, fd);
+  if (node != NULL && node->file != NULL)
+    file = file_hold(node->file);
+  lock_release(&p->fd_lock);
+  return file;
+}
+
+/* Closes FD in P and makes it available for reuse. Returns false
+   if FD was not open. */
+bool fd_close(struct process* p, int fd) {
+  struct file* file;
+  struct dir* dir;
+
+  lock_acquire(&p->fd_lock);
+  fd_node* node = fd_lookup(p, fd);
+  if (node == NULL) {
+    lock_release(&p->fd_lock);
+    return false;
+  }
+  file = node->file;
+  dir = node->dir;
+  node->file = NULL;
+  node->dir = NULL;
+  if (fd < p->fd_low)
+    p->fd_low = fd;
+  lock_release(&p->fd_lock);
+
+  if (file)
+    file_close(file);
+  else
+    dir_close(dir);
+  return true;
+}
+
+/* Closes every fd open in P and frees its table.  No other thread
+   of P may be running. */
+void fd_close_all(struct process* p) {
+  for (int fd = FD_FIRST; fd < p->fd_cap; fd++)
+    fd_close(p, fd);
+  free(p->fd_table);
+  p->fd_table = NULL;
+  p->fd_cap = 0;
+  p->fd_low = FD_FIRST;
+}
 
 bool pfile_is_dir(struct file* file) { return file_is_dir(file); }
 
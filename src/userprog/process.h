@@ -2,11 +2,14 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include "userprog/usersync.h"
+#include <hash.h>
 #include <stdint.h>
+#include <syscall-nr.h>
 
 // At most 8MB can be allocated to the stack
 // These defines will be used in Project 2: Multithreading
-#define MAX_STACK_PAGES (1 << 11)
+#define MAX_STACK_PAGES (USER_STACK_SLOT_SIZE / PGSIZE)
 #define MAX_THREADS 127
 
 /* PIDs and TIDs are the same type. PID should be
@@ -27,13 +30,33 @@ struct process {
   uint32_t* pagedir;            /* Page directory. */
   char process_name[16];        /* Name of the main thread */
   struct thread* main_thread;   /* Pointer to main thread */
-  struct list fd_list;          /* A pintos list of fds open to the process. */
-  int next_fd;                  /* Next available fd. */
+  struct fd_node* fd_table;     /* Open files, indexed by fd. */
+  int fd_cap;                   /* Number of slots in fd_table. */
+  int fd_low;                   /* No free fd below this one. */
   struct list child_list;       /* List of child nodes. */
   struct pcb_metadata* my_data; /* Metadata for current process */
   struct file*
       executable; /*deny write to this file,store this file when load, then enable write when exit*/
   struct dir* cwd;
+  struct lock fd_lock;              /* Guards FD_TABLE, see fd_lookup(). */
+  struct list threads;              /* User threads not yet joined, see pthread_execute(). */
+  struct lock thread_lock;          /* Guards the thread members below and THREADS. */
+  struct condition thread_exited;   /* Signalled whenever a thread exits. */
+  int live_threads;                 /* Threads that have not exited. */
+  bool exiting;                     /* Some thread has called process_exit(). */
+  bool stack_used[MAX_THREADS];     /* User stack slots in use; 0 is the main thread's. */
+  struct user_lock* user_locks[USER_SYNC_MAX]; /* Locks by handle, see usersync.c. */
+  struct semaphore* user_semas[USER_SYNC_MAX]; /* Semaphores by handle. */
+  int user_lock_cnt;                           /* Lock handles given out. */
+  int user_sema_cnt;                           /* Semaphore handles given out. */
+  struct lock sync_lock;                       /* Guards handing out handles. */
+  struct list futex_waiters;                   /* Threads in SYS_FUTEX_WAIT. */
+#ifdef VM
+  struct hash pages;     /* Supplemental page table, see vm/page.c. */
+  struct lock page_lock; /* Guards PAGES and page faults. */
+  struct list mmap_list; /* Memory-mapped files, see vm/mmap.c. */
+  int next_mapid;        /* Id for the next mapping. */
+#endif
 };
 
 /* Process States */
@@ -57,6 +80,16 @@ struct pcb_metadata {
   int exit_status;
 };
 
+/* A user thread of a process. Its record stays on the process's
+   thread list until another thread joins it or the process exits. */
+struct user_thread {
+  tid_t tid;             /* Thread id. */
+  int slot;              /* User stack slot, see stack_top(). */
+  bool joined;           /* Some thread has claimed the join. */
+  struct semaphore done; /* Upped when the thread exits. */
+  struct list_elem elem; /* Element in the process's thread list. */
+};
+
 /* Used in start process */
 struct startup_pack {
   char* fn_copy;
@@ -64,12 +97,16 @@ struct startup_pack {
   struct pcb_metadata* my_data;
 };
 
-/* Structure to store data for a pintos list of fds (node in the list). */
-typedef struct FileDescriptorNode {
-  int fdIndex;
+/* First fd handed out by fd_alloc; 0 and 1 are the console. */
+#define FD_FIRST 2
+
+/* Initial fd_table size. The table doubles whenever it fills up. */
+#define FD_TABLE_MIN 16
+
+/* A slot in the fd table. A slot is free when both members are NULL. */
+typedef struct fd_node {
   struct file* file;
   struct dir* dir;
-  struct list_elem elem;
 } fd_node;
 
 void userprog_init(void);
@@ -88,6 +125,14 @@ tid_t pthread_execute(stub_fun, pthread_fun, void*);
 tid_t pthread_join(tid_t);
 void pthread_exit(void);
 void pthread_exit_main(void);
+void pthread_exit_if_killed(void);
+bool user_stack_contains(const void* uaddr);
+
+int fd_alloc(struct process*, struct file*, struct dir*);
+fd_node* fd_lookup(struct process*, int fd);
+struct file* fd_file(struct process*, int fd);
+bool fd_close(struct process*, int fd);
+void fd_close_all(struct process*);
 
 bool pfile_is_dir(struct file*);
 struct inode* pget_inode(struct file*);
@@ -4,12 +4,20 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "userprog/process.h"
+#include "userprog/usersync.h"
 #include "lib/kernel/console.h"
 #include <stdlib.h>
+#include <string.h>
 #include "userprog/pagedir.h"
 #include "threads/vaddr.h"
 
 #include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static void syscall_handler(struct intr_frame*);
 
@@ -18,12 +26,57 @@ void syscall_init(void) {
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Returns true if the user page containing UADDR is mapped,
+   bringing it in first if it has not been touched yet. */
+static bool user_page_present(const void* uaddr) {
+  if (pagedir_get_page(thread_current()->pcb->pagedir, uaddr) != NULL)
+    return true;
+#ifdef VM
+  return page_fault_in(uaddr, false, thread_current()->user_esp);
+#else
+  return false;
+#endif
+}
+
+/* Returns true if UADDR is a mapped byte of user memory. */
+static bool user_byte_ok(const void* uaddr) {
+  return uaddr != NULL && is_user_vaddr(uaddr) && user_page_present(uaddr);
+}
+
+/* Returns true if UADDR is an aligned, mapped word of user
+   memory, as futexes must be. */
+static bool user_word_ok(const int* uaddr) {
+  return ((uintptr_t)uaddr & (sizeof *uaddr - 1)) == 0 && user_byte_ok(uaddr);
+}
+
+#ifndef VM
+/* Returns true if all SIZE bytes at BUFFER are mapped user
+   memory, and writable as well if WRITE is true.  The file
+   system copies to and from a caller's buffer while it holds a
+   cache slot locked, so without VM, where the buffer cannot be
+   pinned, it must be checked up front: a fault in the middle of
+   the copy would kill the process with the slot still locked. */
+static bool user_buf_ok(const void* buffer, size_t size, bool write) {
+  uint32_t* pd = thread_current()->pcb->pagedir;
+  const uint8_t* start = buffer;
+  const uint8_t* last = start + size - 1;
+
+  if (size == 0)
+    return true;
+  if (start == NULL || last < start || !is_user_vaddr(last))
+    return false;
+  for (const uint8_t* upage = pg_round_down(start); upage <= last; upage += PGSIZE)
+    if (!user_page_present(upage) || (write && !pagedir_is_writable(pd, upage)))
+      return false;
+  return true;
+}
+#endif
+
 /* verify if address is a valid address in user space */
 bool valid_address(const void* addr) {
   if (addr != NULL && is_user_vaddr(addr)) {
     if ((unsigned long)pg_round_up(addr) - (unsigned long)addr < 4 &&
-        (!is_user_vaddr(addr + 1) ||
-         pagedir_get_page(thread_current()->pcb->pagedir, addr + 1) == NULL))
+        (!is_user_vaddr(addr + 1) || !user_page_present(addr + 1)))
       return false;
     else if (*((int*)addr) == NULL)
       return false;
@@ -35,8 +88,7 @@ bool valid_address(const void* addr) {
 bool valid_address_int(const void* addr) {
   if (addr != NULL && is_user_vaddr(addr) && addr < 0xc0000000) {
     if ((unsigned long)pg_round_up(addr) - (unsigned long)addr < 4 &&
-        (!is_user_vaddr(addr + 1) ||
-         pagedir_get_page(thread_current()->pcb->pagedir, addr + 1) == NULL))
+        (!is_user_vaddr(addr + 1) || !user_page_present(addr + 1)))
       return false;
     return true;
   }
@@ -59,6 +111,14 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
    */
 
   /* printf("System call number: %d\n", args[0]); */
+
+  /* Page faults on user memory from here on grow the stack relative
+     to the user's esp, not the kernel's. */
+  thread_current()->user_esp = f->esp;
+
+  /* Another thread may have begun exiting the process. */
+  pthread_exit_if_killed();
+
   if (f->esp <= f->eip || !valid_address(args)) {
     printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
     process_exit(-1);
@@ -69,11 +129,11 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     void* buffer;
     unsigned size;
     const char* file;
-    struct list_elem* e;
+    fd_node* node;
+    struct file* io_file;
     const char* dir;
 
     case SYS_HALT:
-      cache_flush();
       shutdown_power_off();
       break;
     case SYS_EXIT:
@@ -111,7 +171,13 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
         break;
       }
       fd = args[1];
-      f->eax = sys_sum_to_e(fd);
+      {
+        /* The FPU may still hold the user program's registers. */
+        uint8_t user_fpu[FPU_SIZE];
+        asm volatile("fnsave %0" : "=m"(user_fpu));
+        f->eax = sys_sum_to_e(fd);
+        asm volatile("frstor %0" : : "m"(user_fpu));
+      }
       break;
     case SYS_EXEC:
       if (!valid_address(args + 1)) {
@@ -179,18 +245,13 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
         }
       }
       if (new_file || new_dir) {
-        fd_node* newFileNode = (fd_node*)malloc(sizeof(fd_node));
-        newFileNode->fdIndex = thread_current()->pcb->next_fd;
-        newFileNode->file = new_file;
-        newFileNode->dir = new_dir;
-        if (new_dir) {
-          char name[15];
-          dir_readdir(newFileNode->dir, name);
-          dir_readdir(newFileNode->dir, name);
+        f->eax = fd_alloc(thread_current()->pcb, new_file, new_dir);
+        if ((int)f->eax == -1) {
+          if (new_file)
+            file_close(new_file);
+          else
+            dir_close(new_dir);
         }
-        list_push_back(&thread_current()->pcb->fd_list, &newFileNode->elem);
-        thread_current()->pcb->next_fd++;
-        f->eax = newFileNode->fdIndex;
       }
       break;
     case SYS_FILESIZE:
@@ -200,13 +261,11 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
         break;
       }
       fd = args[1];
-      for (e = list_begin(&thread_current()->pcb->fd_list);
-           e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-        fd_node* node = list_entry(e, fd_node, elem);
-        if (node->fdIndex == fd) {
-          f->eax = file_length(node->file);
-        }
-      }
+      lock_acquire(&thread_current()->pcb->fd_lock);
+      node = fd_lookup(thread_current()->pcb, fd);
+      if (node != NULL && node->file != NULL)
+        f->eax = file_length(node->file);
+      lock_release(&thread_current()->pcb->fd_lock);
       break;
     case SYS_READ:
       if (!valid_address_int(args + 1) || !valid_address(args + 2) || args[2] >= 0xc0000000 ||
@@ -218,6 +277,15 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       fd = args[1];
       buffer = (void*)args[2];
       size = args[3];
+#ifdef VM
+      if (!page_pin(buffer, size, true)) {
+#else
+      if (!user_buf_ok(buffer, size, true)) {
+#endif
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
       if (fd == 0) {
         for (unsigned i = 0; i < size; i++) {
           uint8_t key = input_getc();
@@ -227,19 +295,13 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       } else if (fd == 1) { //should not be reading from stdout
         // throw error
       } else {
-        for (e = list_begin(&thread_current()->pcb->fd_list);
-             e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-          fd_node* node = list_entry(e, fd_node, elem);
-          if (node->fdIndex == fd) {
-            if (node->file == NULL) {
-              f->eax = -1;
-              break;
-            }
-            f->eax = file_read(node->file, buffer, size);
-            break;
-          }
-        }
+        io_file = fd_file(thread_current()->pcb, fd);
+        f->eax = io_file != NULL ? file_read(io_file, buffer, size) : -1;
+        file_close(io_file);
       }
+#ifdef VM
+      page_unpin(buffer, size);
+#endif
       break;
     case SYS_WRITE:
       if (!valid_address_int(args + 1) || !valid_address(args + 2) ||
@@ -251,24 +313,27 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       fd = args[1];
       buffer = (void*)args[2];
       size = args[3];
+#ifdef VM
+      if (!page_pin(buffer, size, false)) {
+#else
+      if (!user_buf_ok(buffer, size, false)) {
+#endif
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
       if (fd == 1) {
         putbuf(buffer, size);
       } else if (fd == 0) { //should not be writing to stdin
         // throw error
       } else {
-        for (e = list_begin(&thread_current()->pcb->fd_list);
-             e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-          fd_node* node = list_entry(e, fd_node, elem);
-          if (node->fdIndex == fd) {
-            if (node->file == NULL) {
-              f->eax = -1;
-              break;
-            }
-            f->eax = file_write(node->file, buffer, size);
-            break;
-          }
-        }
+        io_file = fd_file(thread_current()->pcb, fd);
+        f->eax = io_file != NULL ? file_write(io_file, buffer, size) : -1;
+        file_close(io_file);
       }
+#ifdef VM
+      page_unpin(buffer, size);
+#endif
       break;
     case SYS_CLOSE:
       if (!valid_address_int(args + 1)) {
@@ -277,16 +342,7 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
         break;
       }
       fd = args[1];
-      for (e = list_begin(&thread_current()->pcb->fd_list);
-           e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-        fd_node* node = list_entry(e, fd_node, elem);
-        if (node->fdIndex == fd) {
-          f->eax = file_close(node->file);
-          list_remove(e);
-          free(node);
-          break;
-        }
-      }
+      fd_close(thread_current()->pcb, fd);
       break;
     case SYS_REMOVE:
       if (!valid_address(args + 1)) {
@@ -304,13 +360,11 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
         break;
       }
       fd = args[1];
-      for (e = list_begin(&thread_current()->pcb->fd_list);
-           e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-        fd_node* node = list_entry(e, fd_node, elem);
-        if (node->fdIndex == fd) {
-          f->eax = file_tell(node->file);
-        }
-      }
+      lock_acquire(&thread_current()->pcb->fd_lock);
+      node = fd_lookup(thread_current()->pcb, fd);
+      if (node != NULL && node->file != NULL)
+        f->eax = file_tell(node->file);
+      lock_release(&thread_current()->pcb->fd_lock);
       break;
     case SYS_SEEK:
       if (!valid_address_int(args + 1) || !valid_address_int(args + 2)) {
@@ -320,13 +374,11 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       }
       fd = args[1];
       unsigned position = args[2];
-      for (e = list_begin(&thread_current()->pcb->fd_list);
-           e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-        fd_node* node = list_entry(e, fd_node, elem);
-        if (node->fdIndex == fd) {
-          f->eax = file_seek(node->file, position);
-        }
-      }
+      lock_acquire(&thread_current()->pcb->fd_lock);
+      node = fd_lookup(thread_current()->pcb, fd);
+      if (node != NULL && node->file != NULL)
+        file_seek(node->file, position);
+      lock_release(&thread_current()->pcb->fd_lock);
       break;
     case SYS_CHDIR:
       if (!valid_address(args + 1)) {
@@ -364,15 +416,27 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       }
       fd = args[1];
       char* name = args[2];
-      f->eax = false;
-      for (struct list_elem* e = list_begin(&thread_current()->pcb->fd_list);
-           e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-        fd_node* node = list_entry(e, fd_node, elem);
-        if (node->fdIndex == fd && node->dir != NULL) {
-          f->eax = dir_readdir(node->dir, name);
-          break;
-        }
+#ifdef VM
+      if (!page_pin(name, NAME_MAX + 1, true)) {
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
       }
+#endif
+      f->eax = false;
+      /* Read the name into the kernel under fd_lock and copy it
+         out after, so that a bad NAME faults with no lock held. */
+      char readdir_name[NAME_MAX + 1];
+      lock_acquire(&thread_current()->pcb->fd_lock);
+      node = fd_lookup(thread_current()->pcb, fd);
+      if (node != NULL && node->dir != NULL)
+        f->eax = dir_readdir(node->dir, readdir_name);
+      lock_release(&thread_current()->pcb->fd_lock);
+      if (f->eax)
+        strlcpy(name, readdir_name, NAME_MAX + 1);
+#ifdef VM
+      page_unpin(name, NAME_MAX + 1);
+#endif
       break;
     case SYS_ISDIR:
       if (!valid_address_int(args + 1)) {
@@ -382,14 +446,11 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
       }
       fd = args[1];
       f->eax = false;
-      for (e = list_begin(&thread_current()->pcb->fd_list);
-           e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-        fd_node* node = list_entry(e, fd_node, elem);
-        if (node->fdIndex == fd) {
-          f->eax = node->dir != NULL;
-          break;
-        }
-      }
+      lock_acquire(&thread_current()->pcb->fd_lock);
+      node = fd_lookup(thread_current()->pcb, fd);
+      if (node != NULL)
+        f->eax = node->dir != NULL;
+      lock_release(&thread_current()->pcb->fd_lock);
       break;
     case SYS_INUMBER:
       if (!valid_address_int(args + 1)) {
@@ -398,17 +459,15 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
         break;
       }
       fd = args[1];
-      for (e = list_begin(&thread_current()->pcb->fd_list);
-           e != list_end(&thread_current()->pcb->fd_list); e = list_next(e)) {
-        fd_node* node = list_entry(e, fd_node, elem);
-        if (node->fdIndex == fd) {
-          if (node->file)
-            f->eax = pget_inum(node->file);
-          else
-            f->eax = inode_get_inumber(dir_get_inode(node->dir));
-          break;
-        }
-      }
+      lock_acquire(&thread_current()->pcb->fd_lock);
+      node = fd_lookup(thread_current()->pcb, fd);
+      if (node != NULL) {
+        if (node->file)
+          f->eax = pget_inum(node->file);
+        else
+          f->eax = inode_get_inumber(dir_get_inode(node->dir));
+      }
+      lock_release(&thread_current()->pcb->fd_lock);
       break;
     case SYS_CACHE_HR:
       f->eax = get_hitrate();
@@ -422,5 +481,118 @@ static void syscall_handler(struct intr_frame* f UNUSED) {
     case SYS_BLK_WR:
       f->eax = get_fs_writes();
       break;
+    case SYS_RA_HITS:
+      f->eax = get_read_ahead_hits();
+      break;
+    case SYS_RA_MISSES:
+      f->eax = get_read_ahead_misses();
+      break;
+    case SYS_CACHE_LOOKUPS:
+      f->eax = get_cache_lookups();
+      break;
+    case SYS_CACHE_COMPARES:
+      f->eax = get_cache_lookup_compares();
+      break;
+#ifdef VM
+    case SYS_MMAP:
+      if (!valid_address_int(args + 1) || !valid_address_int(args + 2)) {
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
+      fd = args[1];
+      f->eax = MAP_FAILED;
+      struct file* map_file = NULL;
+      lock_acquire(&thread_current()->pcb->fd_lock);
+      node = fd_lookup(thread_current()->pcb, fd);
+      if (node != NULL && node->file != NULL)
+        map_file = file_reopen(node->file);
+      lock_release(&thread_current()->pcb->fd_lock);
+      if (map_file != NULL)
+        f->eax = mmap_map(map_file, (void*)args[2]);
+      break;
+    case SYS_MUNMAP:
+      if (!valid_address_int(args + 1)) {
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
+      mmap_unmap(args[1]);
+      break;
+#endif
+    case SYS_PT_CREATE:
+      if (!valid_address_int(args + 1) || !valid_address_int(args + 2) ||
+          !valid_address_int(args + 3)) {
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
+      f->eax = pthread_execute((stub_fun)args[1], (pthread_fun)args[2], (void*)args[3]);
+      break;
+    case SYS_PT_EXIT:
+      if (is_main_thread(thread_current(), thread_current()->pcb))
+        pthread_exit_main();
+      else
+        pthread_exit();
+      break;
+    case SYS_PT_JOIN:
+      if (!valid_address_int(args + 1)) {
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
+      f->eax = pthread_join(args[1]);
+      break;
+    case SYS_GET_TID:
+      f->eax = thread_current()->tid;
+      break;
+    case SYS_LOCK_INIT:
+    case SYS_LOCK_ACQUIRE:
+    case SYS_LOCK_RELEASE:
+    case SYS_SEMA_DOWN:
+    case SYS_SEMA_UP:
+      if (!valid_address_int(args + 1)) {
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
+      f->eax = false;
+      if (!user_byte_ok((char*)args[1]))
+        break;
+      if (args[0] == SYS_LOCK_INIT)
+        f->eax = usersync_lock_init((lock_t*)args[1]);
+      else if (args[0] == SYS_LOCK_ACQUIRE)
+        f->eax = usersync_lock_acquire(*(lock_t*)args[1]);
+      else if (args[0] == SYS_LOCK_RELEASE)
+        f->eax = usersync_lock_release(*(lock_t*)args[1]);
+      else if (args[0] == SYS_SEMA_DOWN)
+        f->eax = usersync_sema_down(*(sema_t*)args[1]);
+      else
+        f->eax = usersync_sema_up(*(sema_t*)args[1]);
+      break;
+    case SYS_SEMA_INIT:
+      if (!valid_address_int(args + 1) || !valid_address_int(args + 2)) {
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
+      f->eax = user_byte_ok((char*)args[1]) && usersync_sema_init((sema_t*)args[1], args[2]);
+      break;
+    case SYS_FUTEX_WAIT:
+    case SYS_FUTEX_WAKE:
+      if (!valid_address_int(args + 1) || !valid_address_int(args + 2)) {
+        printf("%s: exit(%d)\n", thread_current()->pcb->process_name, -1);
+        process_exit(-1);
+        break;
+      }
+      if (!user_word_ok((int*)args[1]))
+        f->eax = -1;
+      else if (args[0] == SYS_FUTEX_WAIT)
+        f->eax = usersync_futex_wait((int*)args[1], args[2]) ? 0 : -1;
+      else
+        f->eax = usersync_futex_wake((int*)args[1], args[2]);
+      break;
   }
+
+  pthread_exit_if_killed();
 }
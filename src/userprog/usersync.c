@@ -0,0 +1,257 @@
+#include "userprog/usersync.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* User synchronization.
+
+   SYS_LOCK_* and SYS_SEMA_* operate on kernel objects kept in a
+   per-process table, indexed by the one-byte handle stored in the
+   user's lock_t or sema_t.  Handles are never reused, since the
+   objects live as long as the process.
+
+   SYS_FUTEX_WAIT and SYS_FUTEX_WAKE are the slow path for user
+   code that keeps a lock in a word of user memory: uncontended
+   operations are atomic instructions in user space, and the
+   kernel is entered only to sleep while the word says the lock
+   is contended.  The user library's lock_t and sema_t work that
+   way on top of the handles (see lib/user/syscall.c), so the
+   kernel objects serve callers of the other syscalls.
+
+   A thread must not sleep in here once its process has started
+   exiting, or process_exit() would wait for it forever.  So each
+   sleeper checks the process's exiting flag and queues itself
+   with interrupts off, and usersync_wake_all() wakes everything
+   queued, also with interrupts off.  The sleepers then die on
+   their way back to user mode. */
+
+/* Initializes P's lock and semaphore tables and futex queue. */
+void usersync_init(struct process* p) {
+  for (int i = 0; i < USER_SYNC_MAX; i++) {
+    p->user_locks[i] = NULL;
+    p->user_semas[i] = NULL;
+  }
+  p->user_lock_cnt = 0;
+  p->user_sema_cnt = 0;
+  lock_init(&p->sync_lock);
+  list_init(&p->futex_waiters);
+}
+
+/* Ups SEMA once for each thread waiting on it. */
+static void wake_waiters(struct semaphore* sema) {
+  while (!list_empty(&sema->waiters))
+    sema_up(sema);
+}
+
+/* Wakes every thread of P asleep on a user lock, semaphore or
+   futex.  P must already be marked as exiting. */
+void usersync_wake_all(struct process* p) {
+  enum intr_level old_level = intr_disable();
+
+  ASSERT(p->exiting);
+  for (int i = 0; i < p->user_lock_cnt; i++)
+    wake_waiters(&p->user_locks[i]->sema);
+  for (int i = 0; i < p->user_sema_cnt; i++)
+    wake_waiters(p->user_semas[i]);
+  while (!list_empty(&p->futex_waiters)) {
+    struct list_elem* e = list_pop_front(&p->futex_waiters);
+    sema_up(&list_entry(e, struct futex_waiter, elem)->wakeup);
+  }
+  intr_set_level(old_level);
+}
+
+/* Frees P's locks and semaphores.  No thread of P may be left. */
+void usersync_destroy(struct process* p) {
+  for (int i = 0; i < p->user_lock_cnt; i++)
+    free(p->user_locks[i]);
+  for (int i = 0; i < p->user_sema_cnt; i++)
+    free(p->user_semas[i]);
+  p->user_lock_cnt = 0;
+  p->user_sema_cnt = 0;
+}
+
+/* Downs SEMA unless the current process is exiting, checking and
+   queueing with interrupts off so that usersync_wake_all() cannot
+   miss us.  Returns false if the process is exiting. */
+static bool sleep_unless_exiting(struct semaphore* sema) {
+  struct process* p = thread_current()->pcb;
+  enum intr_level old_level = intr_disable();
+  bool alive = !p->exiting;
+
+  if (alive)
+    sema_down(sema);
+  alive = !p->exiting;
+  intr_set_level(old_level);
+  return alive;
+}
+
+/* Creates a lock and stores its handle in *LOCK, which must be
+   user memory.  Returns false if the table is full or memory is
+   short.  The handle is stored only after sync_lock is released,
+   so that a fault on *LOCK kills the process without leaving
+   sync_lock held against its other threads. */
+bool usersync_lock_init(lock_t* lock) {
+  struct process* p = thread_current()->pcb;
+  struct user_lock* l;
+  int handle = -1;
+
+  lock_acquire(&p->sync_lock);
+  if (p->user_lock_cnt < USER_SYNC_MAX && (l = malloc(sizeof *l)) != NULL) {
+    sema_init(&l->sema, 1);
+    l->holder = NULL;
+    handle = p->user_lock_cnt;
+    p->user_locks[p->user_lock_cnt] = l;
+    barrier(); /* usersync_wake_all() may run between these. */
+    p->user_lock_cnt++;
+  }
+  lock_release(&p->sync_lock);
+  if (handle < 0)
+    return false;
+  *lock = handle;
+  return true;
+}
+
+/* Returns the lock of the current process with HANDLE, or NULL. */
+static struct user_lock* lock_lookup(lock_t handle) {
+  return thread_current()->pcb->user_locks[(unsigned char)handle];
+}
+
+/* Acquires the lock with HANDLE, sleeping until it is free.
+   Returns false if there is no such lock or the caller already
+   holds it. */
+bool usersync_lock_acquire(lock_t handle) {
+  struct user_lock* l = lock_lookup(handle);
+
+  if (l == NULL || l->holder == thread_current())
+    return false;
+  if (sleep_unless_exiting(&l->sema))
+    l->holder = thread_current();
+  return true;
+}
+
+/* Releases the lock with HANDLE.  Returns false if there is no
+   such lock or the caller does not hold it. */
+bool usersync_lock_release(lock_t handle) {
+  struct user_lock* l = lock_lookup(handle);
+
+  if (l == NULL || l->holder != thread_current())
+    return false;
+  l->holder = NULL;
+  sema_up(&l->sema);
+  return true;
+}
+
+/* Creates a semaphore with VALUE and stores its handle in *SEMA,
+   which must be user memory.  Returns false if VALUE is
+   negative, the table is full or memory is short.  As in
+   usersync_lock_init(), *SEMA is stored outside sync_lock. */
+bool usersync_sema_init(sema_t* sema, int value) {
+  struct process* p = thread_current()->pcb;
+  struct semaphore* s;
+  int handle = -1;
+
+  if (value < 0)
+    return false;
+
+  lock_acquire(&p->sync_lock);
+  if (p->user_sema_cnt < USER_SYNC_MAX && (s = malloc(sizeof *s)) != NULL) {
+    sema_init(s, value);
+    handle = p->user_sema_cnt;
+    p->user_semas[p->user_sema_cnt] = s;
+    barrier();
+    p->user_sema_cnt++;
+  }
+  lock_release(&p->sync_lock);
+  if (handle < 0)
+    return false;
+  *sema = handle;
+  return true;
+}
+
+/* Returns the semaphore of the current process with HANDLE, or
+   NULL. */
+static struct semaphore* sema_lookup(sema_t handle) {
+  return thread_current()->pcb->user_semas[(unsigned char)handle];
+}
+
+/* Downs the semaphore with HANDLE.  Returns false if there is no
+   such semaphore. */
+bool usersync_sema_down(sema_t handle) {
+  struct semaphore* s = sema_lookup(handle);
+
+  if (s == NULL)
+    return false;
+  sleep_unless_exiting(s);
+  return true;
+}
+
+/* Ups the semaphore with HANDLE.  Returns false if there is no
+   such semaphore. */
+bool usersync_sema_up(sema_t handle) {
+  struct semaphore* s = sema_lookup(handle);
+
+  if (s == NULL)
+    return false;
+  sema_up(s);
+  return true;
+}
+
+/* Sleeps until woken by usersync_futex_wake() on UADDR, a word of
+   valid user memory, provided *UADDR still equals VALUE.  The
+   comparison and queueing are atomic with respect to wakers.
+   Returns false without sleeping if *UADDR differs. */
+bool usersync_futex_wait(const int* uaddr, int value) {
+  struct process* p = thread_current()->pcb;
+  struct futex_waiter w;
+  enum intr_level old_level;
+  bool queued;
+
+  w.uaddr = uaddr;
+  sema_init(&w.wakeup, 0);
+
+#ifdef VM
+  /* Reading *UADDR must not fault with interrupts off. */
+  if (!page_pin(uaddr, sizeof *uaddr, false))
+    return false;
+#endif
+  old_level = intr_disable();
+  queued = *uaddr == value && !p->exiting;
+  if (queued)
+    list_push_back(&p->futex_waiters, &w.elem);
+  intr_set_level(old_level);
+#ifdef VM
+  page_unpin(uaddr, sizeof *uaddr);
+#endif
+
+  /* A wakeup that came in since we were queued is kept by the
+     semaphore. */
+  if (queued)
+    sema_down(&w.wakeup);
+  return queued;
+}
+
+/* Wakes up to CNT threads asleep on UADDR, oldest first.  Returns
+   the number woken. */
+int usersync_futex_wake(const int* uaddr, int cnt) {
+  struct process* p = thread_current()->pcb;
+  enum intr_level old_level = intr_disable();
+  struct list_elem* e = list_begin(&p->futex_waiters);
+  int woken = 0;
+
+  while (woken < cnt && e != list_end(&p->futex_waiters)) {
+    struct futex_waiter* w = list_entry(e, struct futex_waiter, elem);
+    if (w->uaddr == uaddr) {
+      e = list_remove(e);
+      sema_up(&w->wakeup);
+      woken++;
+    } else
+      e = list_next(e);
+  }
+  intr_set_level(old_level);
+  return woken;
+}
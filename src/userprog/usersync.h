@@ -0,0 +1,46 @@
+#ifndef USERPROG_USERSYNC_H
+#define USERPROG_USERSYNC_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct process;
+
+/* Handles are a single byte in user memory, so a process has at
+   most this many locks and as many semaphores. */
+#define USER_SYNC_MAX 256
+
+/* User handle types, as in lib/user/syscall.h. */
+typedef char lock_t;
+typedef char sema_t;
+
+/* A lock created by SYS_LOCK_INIT.  It is a binary semaphore plus
+   a holder, so that a process exiting can wake its waiters. */
+struct user_lock {
+  struct semaphore sema; /* 1 if free, 0 if held. */
+  struct thread* holder; /* Thread holding the lock, or NULL. */
+};
+
+/* A thread asleep in SYS_FUTEX_WAIT.  Lives on its kernel stack. */
+struct futex_waiter {
+  const int* uaddr;         /* User word slept on. */
+  struct semaphore wakeup;  /* Upped by usersync_futex_wake(). */
+  struct list_elem elem;    /* Element in the process's futex_waiters. */
+};
+
+void usersync_init(struct process*);
+void usersync_wake_all(struct process*);
+void usersync_destroy(struct process*);
+
+bool usersync_lock_init(lock_t*);
+bool usersync_lock_acquire(lock_t);
+bool usersync_lock_release(lock_t);
+bool usersync_sema_init(sema_t*, int value);
+bool usersync_sema_down(sema_t);
+bool usersync_sema_up(sema_t);
+
+bool usersync_futex_wait(const int* uaddr, int value);
+int usersync_futex_wake(const int* uaddr, int cnt);
+
+#endif /* userprog/usersync.h */
@@ -0,0 +1,303 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Frame table.
+
+   Every user pool page that holds a process page is on
+   FRAME_TABLE.  When the user pool runs dry, frame_alloc() takes a
+   frame from another page, chosen by the clock algorithm: the hand
+   sweeps the table, giving frames whose accessed bit is set in any
+   mapping a second chance and clearing the bits as it goes.
+
+   Frames holding clean executable pages are also entered in the
+   share table, so that processes running the same program map one
+   copy of each such page.  A shared frame is always mapped
+   read-only; writable pages of the executable are copied on the
+   first write (see page.c).
+
+   Lock order is each owner's page_lock, then frame_lock, which
+   also guards the share table.  The sweep runs under frame_lock,
+   so it only try-acquires owners' locks and passes over frames
+   whose owners are busy. */
+
+static struct list frame_table; /* All frames in use. */
+static struct list_elem* hand;  /* Next frame the clock looks at. */
+static struct hash share_table; /* Shared frames, by inode and offset. */
+static struct lock frame_lock;  /* Guards everything above and frame fields. */
+
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initializes the frame table. */
+void frame_init(void) {
+  list_init(&frame_table);
+  hand = list_end(&frame_table);
+  if (!hash_init(&share_table, share_hash, share_less, NULL))
+    PANIC("share table allocation failed");
+  lock_init(&frame_lock);
+}
+
+/* Returns the frame under the clock hand and advances the hand. */
+static struct frame* clock_next(void) {
+  if (hand == list_end(&frame_table))
+    hand = list_begin(&frame_table);
+  struct frame* f = list_entry(hand, struct frame, elem);
+  hand = list_next(hand);
+  return f;
+}
+
+/* Returns true if F has been accessed through any of its
+   mappings since the last sweep, and clears the accessed bits. */
+static bool frame_accessed(struct frame* f) {
+  bool accessed = false;
+
+  for (struct list_elem* e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e)) {
+    struct page* page = list_entry(e, struct page, frame_elem);
+    uint32_t* pd = page->owner->pagedir;
+    if (pagedir_is_accessed(pd, page->upage)) {
+      pagedir_set_accessed(pd, page->upage, false);
+      accessed = true;
+    }
+  }
+  return accessed;
+}
+
+/* Releases the owner locks taken by lock_owners() for the pages
+   of F before STOP. */
+static void unlock_owners(struct frame* f, struct list_elem* stop) {
+  for (struct list_elem* e = list_begin(&f->pages); e != stop; e = list_next(e)) {
+    struct page* page = list_entry(e, struct page, frame_elem);
+    if (page->evict_locked)
+      lock_release(&page->owner->page_lock);
+  }
+}
+
+/* Takes the page_lock of every owner of F without blocking.
+   Locks the current thread already holds are not taken again.
+   Returns false, holding none of them, if any owner is busy. */
+static bool lock_owners(struct frame* f) {
+  for (struct list_elem* e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e)) {
+    struct page* page = list_entry(e, struct page, frame_elem);
+    struct lock* lock = &page->owner->page_lock;
+
+    page->evict_locked = false;
+    if (lock_held_by_current_thread(lock))
+      continue;
+    if (!lock_try_acquire(lock)) {
+      unlock_owners(f, e);
+      return false;
+    }
+    page->evict_locked = true;
+  }
+  return true;
+}
+
+/* Picks a frame to evict, pins it and takes it out of the share
+   table.  A private page that would have to go to swap is passed
+   over if swap is full.  On success the page_lock of every owner
+   is held.  Returns NULL if no frame can be taken.  Must be
+   called with frame_lock held. */
+static struct frame* choose_victim(void) {
+  size_t frame_cnt = list_size(&frame_table);
+  bool no_swap = swap_full();
+
+  /* Two full sweeps: the first may only clear accessed bits. */
+  for (size_t i = 0; i < 2 * frame_cnt; i++) {
+    struct frame* f = clock_next();
+    if (f->pin_cnt > 0 || frame_accessed(f))
+      continue;
+
+    if (no_swap && !f->shared) {
+      struct page* page = list_entry(list_front(&f->pages), struct page, frame_elem);
+      if (pagedir_is_dirty(page->owner->pagedir, page->upage))
+        continue;
+    }
+    if (!lock_owners(f))
+      continue;
+
+    f->pin_cnt = 1;
+    if (f->shared) {
+      hash_delete(&share_table, &f->share_elem);
+      f->shared = false;
+    }
+    return f;
+  }
+  return NULL;
+}
+
+/* Returns a pinned frame holding PAGE, evicting the pages of
+   another frame if the user pool is exhausted.  Returns NULL if
+   no frame is available.  The caller must hold the page_lock of
+   PAGE's owner and must unpin the frame once PAGE is mapped. */
+struct frame* frame_alloc(struct page* page) {
+  struct frame* f;
+  void* kpage = palloc_get_page(PAL_USER);
+
+  if (kpage != NULL) {
+    f = malloc(sizeof *f);
+    if (f == NULL) {
+      palloc_free_page(kpage);
+      return NULL;
+    }
+    f->kpage = kpage;
+    list_init(&f->pages);
+    list_push_back(&f->pages, &page->frame_elem);
+    f->pin_cnt = 1;
+    f->shared = false;
+    lock_acquire(&frame_lock);
+    list_push_back(&frame_table, &f->elem);
+    lock_release(&frame_lock);
+    return f;
+  }
+
+  lock_acquire(&frame_lock);
+  f = choose_victim();
+  lock_release(&frame_lock);
+  if (f == NULL)
+    return NULL;
+
+  /* F is pinned and out of the share table, so it stays ours while
+     the old pages are unmapped and saved. */
+  for (struct list_elem* e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e)) {
+    struct page* old = list_entry(e, struct page, frame_elem);
+    page_evict(old->owner, old);
+  }
+  unlock_owners(f, list_end(&f->pages));
+
+  lock_acquire(&frame_lock);
+  list_init(&f->pages);
+  list_push_back(&f->pages, &page->frame_elem);
+  lock_release(&frame_lock);
+  return f;
+}
+
+/* Frees F if no page holds it and it is not pinned.  Must be
+   called with frame_lock held. */
+static void frame_free_if_unused(struct frame* f) {
+  if (!list_empty(&f->pages) || f->pin_cnt > 0)
+    return;
+
+  if (f->shared)
+    hash_delete(&share_table, &f->share_elem);
+  if (hand == &f->elem)
+    hand = list_next(hand);
+  list_remove(&f->elem);
+  palloc_free_page(f->kpage);
+  free(f);
+}
+
+/* Removes PAGE from F, freeing F if it was the last page and F
+   is not pinned.  The caller must hold the page_lock of PAGE's
+   owner. */
+void frame_release(struct frame* f, struct page* page) {
+  lock_acquire(&frame_lock);
+  list_remove(&page->frame_elem);
+  frame_free_if_unused(f);
+  lock_release(&frame_lock);
+}
+
+/* Adds PAGE back to F after frame_release().  F must have been
+   pinned, so that it was not freed. */
+void frame_attach(struct frame* f, struct page* page) {
+  lock_acquire(&frame_lock);
+  list_push_back(&f->pages, &page->frame_elem);
+  lock_release(&frame_lock);
+}
+
+/* Keeps F from being evicted. */
+void frame_pin(struct frame* f) {
+  lock_acquire(&frame_lock);
+  f->pin_cnt++;
+  lock_release(&frame_lock);
+}
+
+/* Allows F to be evicted again once every pin is released.  Frees
+   F if it was only being kept for its pin. */
+void frame_unpin(struct frame* f) {
+  lock_acquire(&frame_lock);
+  ASSERT(f->pin_cnt > 0);
+  f->pin_cnt--;
+  frame_free_if_unused(f);
+  lock_release(&frame_lock);
+}
+
+/* Looks up the shared frame holding READ_BYTES bytes of INODE at
+   OFS.  If there is one, adds PAGE to it and returns it pinned;
+   otherwise returns NULL.  The caller must hold the page_lock of
+   PAGE's owner. */
+struct frame* frame_share_find(struct page* page, struct inode* inode, off_t ofs,
+                               uint32_t read_bytes) {
+  struct frame key;
+  struct hash_elem* e;
+  struct frame* f = NULL;
+
+  key.inode = inode;
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+
+  lock_acquire(&frame_lock);
+  e = hash_find(&share_table, &key.share_elem);
+  if (e != NULL) {
+    f = hash_entry(e, struct frame, share_elem);
+    list_push_back(&f->pages, &page->frame_elem);
+    f->pin_cnt++;
+  }
+  lock_release(&frame_lock);
+  return f;
+}
+
+/* Enters F, which holds READ_BYTES bytes of INODE at OFS, in the
+   share table.  If another process got there first F just stays
+   private. */
+void frame_share_add(struct frame* f, struct inode* inode, off_t ofs, uint32_t read_bytes) {
+  f->inode = inode;
+  f->ofs = ofs;
+  f->read_bytes = read_bytes;
+
+  lock_acquire(&frame_lock);
+  f->shared = hash_insert(&share_table, &f->share_elem) == NULL;
+  lock_release(&frame_lock);
+}
+
+/* Makes F private to PAGE if PAGE is the only page holding it,
+   taking it out of the share table.  Returns false if F has other
+   pages. */
+bool frame_make_private(struct frame* f, struct page* page) {
+  bool success;
+
+  lock_acquire(&frame_lock);
+  success = list_size(&f->pages) == 1 &&
+            list_entry(list_front(&f->pages), struct page, frame_elem) == page;
+  if (success && f->shared) {
+    hash_delete(&share_table, &f->share_elem);
+    f->shared = false;
+  }
+  lock_release(&frame_lock);
+  return success;
+}
+
+/* Returns a hash value for shared frame E. */
+static unsigned share_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct frame* f = hash_entry(e, struct frame, share_elem);
+  unsigned key[3] = {(unsigned)f->inode, (unsigned)f->ofs, f->read_bytes};
+  return hash_bytes(key, sizeof key);
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool share_less(const struct hash_elem* a_, const struct hash_elem* b_, void* aux UNUSED) {
+  const struct frame* a = hash_entry(a_, struct frame, share_elem);
+  const struct frame* b = hash_entry(b_, struct frame, share_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,42 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct inode;
+struct page;
+
+/* A user pool page holding a page of one or more processes.
+
+   A frame holding a clean page of an executable is shared: it is
+   entered in the share table under the page's (inode, offset,
+   length), and every process that faults in the same page maps
+   the same frame read-only. */
+struct frame {
+  void* kpage;                 /* Kernel virtual address of the frame. */
+  struct list pages;           /* Pages held in the frame. */
+  int pin_cnt;                 /* Not to be evicted while nonzero. */
+  bool shared;                 /* In the share table. */
+  struct inode* inode;         /* Share table key: executable inode, */
+  off_t ofs;                   /* offset of the page in it, */
+  uint32_t read_bytes;         /* and bytes read from it. */
+  struct hash_elem share_elem; /* Element in the share table. */
+  struct list_elem elem;       /* Element in the frame table. */
+};
+
+void frame_init(void);
+struct frame* frame_alloc(struct page*);
+void frame_release(struct frame*, struct page*);
+void frame_pin(struct frame*);
+void frame_unpin(struct frame*);
+
+struct frame* frame_share_find(struct page*, struct inode*, off_t ofs, uint32_t read_bytes);
+void frame_share_add(struct frame*, struct inode*, off_t ofs, uint32_t read_bytes);
+bool frame_make_private(struct frame*, struct page*);
+void frame_attach(struct frame*, struct page*);
+
+#endif /* vm/frame.h */
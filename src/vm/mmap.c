@@ -0,0 +1,89 @@
+#include "vm/mmap.h"
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   A mapping records one PAGE_MMAP page per page of the file in
+   the supplemental page table; nothing is read until a page is
+   touched.  Dirty pages are written back when they are evicted or
+   unmapped, so munmap() and process exit only write what was
+   modified. */
+
+/* Initializes P's list of mappings. */
+void mmap_init(struct process* p) {
+  list_init(&p->mmap_list);
+  p->next_mapid = 0;
+}
+
+/* Removes the pages of M and frees it. */
+static void mmap_release(struct mmap* m) {
+  for (size_t i = 0; i < m->page_cnt; i++)
+    page_remove((uint8_t*)m->base + i * PGSIZE);
+  file_close(m->file);
+  free(m);
+}
+
+/* Maps FILE into the current process starting at ADDR and takes
+   ownership of FILE.  Returns the new mapping's id, or MAP_FAILED
+   if ADDR is not page-aligned, the file is empty, or any page of
+   the range is outside user memory or already in use.  FILE is
+   closed on failure. */
+mapid_t mmap_map(struct file* file, void* addr) {
+  struct process* p = thread_current()->pcb;
+  off_t length = file_length(file);
+  size_t page_cnt = DIV_ROUND_UP(length, PGSIZE);
+  struct mmap* m;
+
+  if (addr == NULL || pg_ofs(addr) != 0 || length == 0 ||
+      (uintptr_t)addr + page_cnt * PGSIZE > (uintptr_t)PHYS_BASE ||
+      (m = malloc(sizeof *m)) == NULL) {
+    file_close(file);
+    return MAP_FAILED;
+  }
+  m->file = file;
+  m->base = addr;
+  m->page_cnt = 0;
+
+  for (off_t ofs = 0; ofs < length; ofs += PGSIZE) {
+    uint32_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+    if (!page_add_mmap(file, ofs, (uint8_t*)addr + ofs, read_bytes)) {
+      mmap_release(m);
+      return MAP_FAILED;
+    }
+    m->page_cnt++;
+  }
+
+  m->id = p->next_mapid++;
+  list_push_back(&p->mmap_list, &m->elem);
+  return m->id;
+}
+
+/* Unmaps mapping ID of the current process, writing back any
+   pages that were modified.  Returns false if there is no such
+   mapping. */
+bool mmap_unmap(mapid_t id) {
+  struct process* p = thread_current()->pcb;
+
+  for (struct list_elem* e = list_begin(&p->mmap_list); e != list_end(&p->mmap_list);
+       e = list_next(e)) {
+    struct mmap* m = list_entry(e, struct mmap, elem);
+    if (m->id == id) {
+      list_remove(e);
+      mmap_release(m);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Unmaps every mapping of the current process P. */
+void mmap_destroy(struct process* p) {
+  while (!list_empty(&p->mmap_list))
+    mmap_release(list_entry(list_pop_front(&p->mmap_list), struct mmap, elem));
+}
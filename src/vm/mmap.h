@@ -0,0 +1,29 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct file;
+struct process;
+
+/* Map region identifier. */
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t)-1)
+
+/* A file mapped into a process's address space. */
+struct mmap {
+  mapid_t id;            /* Mapping identifier. */
+  struct file* file;     /* Private handle on the mapped file. */
+  void* base;            /* First mapped user page. */
+  size_t page_cnt;       /* Number of mapped pages. */
+  struct list_elem elem; /* Element in the process's mmap_list. */
+};
+
+void mmap_init(struct process*);
+mapid_t mmap_map(struct file*, void* addr);
+bool mmap_unmap(mapid_t);
+void mmap_destroy(struct process*);
+
+#endif /* vm/mmap.h */
@@ -0,0 +1,419 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   load() records every page of the executable here instead of
+   reading it, and page_fault_in() reads a page the first time the
+   process touches it.  Each process has its own table, keyed by
+   user page address, and a lock that serializes its page faults
+   and the eviction of its pages.
+
+   Pages of the executable are mapped from shared frames when
+   another process running the same program already has them in
+   memory (see frame.c).  A writable one is mapped read-only until
+   the first write fault, which gives the process its own copy.
+
+   A page that is evicted clean is dropped and later read again
+   from its file or zeroed.  A dirty page goes to swap, and a page
+   read back from swap is marked dirty so that it goes to swap
+   again the next time it is evicted.
+
+   Pages of a memory-mapped file are never swapped.  When one is
+   evicted or unmapped dirty it is written back to the file.
+
+   Each thread's stack starts as a single page and grows on
+   demand: a fault on an unrecorded address in the stack area and
+   just below the faulting thread's user stack pointer adds a zero
+   page there.  A stack only grows within its own thread's slot of
+   MAX_STACK_PAGES (see user_stack_contains()). */
+
+/* How far below the user stack pointer a fault still counts as a
+   stack access.  PUSHA writes 32 bytes below esp. */
+#define STACK_SLOP 32
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_free;
+
+/* Initializes P's supplemental page table. */
+void page_table_init(struct process* p) {
+  if (!hash_init(&p->pages, page_hash, page_less, p))
+    PANIC("page table allocation failed");
+  lock_init(&p->page_lock);
+}
+
+/* Frees every page of P, along with the frames and swap slots
+   holding them. */
+void page_table_destroy(struct process* p) {
+  lock_acquire(&p->page_lock);
+  hash_destroy(&p->pages, page_free);
+  lock_release(&p->page_lock);
+}
+
+/* Returns a new page at UPAGE that is not yet in any table, or
+   NULL if memory is short. */
+static struct page* page_create(void* upage, enum page_type type, bool writable) {
+  ASSERT(pg_ofs(upage) == 0);
+
+  struct page* page = malloc(sizeof *page);
+  if (page == NULL)
+    return NULL;
+  page->upage = upage;
+  page->type = type;
+  page->writable = writable;
+  page->file = NULL;
+  page->ofs = 0;
+  page->read_bytes = 0;
+  page->owner = thread_current()->pcb;
+  page->frame = NULL;
+  page->cow = false;
+  page->swap_slot = SWAP_NONE;
+  return page;
+}
+
+/* Adds PAGE to the current process's page table. */
+static bool page_add(struct page* page) {
+  struct process* p = thread_current()->pcb;
+  bool success;
+
+  lock_acquire(&p->page_lock);
+  success = hash_insert(&p->pages, &page->elem) == NULL;
+  lock_release(&p->page_lock);
+  if (!success)
+    free(page);
+  return success;
+}
+
+/* Records that UPAGE in the current process holds READ_BYTES
+   bytes of FILE starting at OFS, followed by zeros to the end of
+   the page.  Nothing is read until the page is touched.  Returns
+   false if UPAGE is already recorded or memory is short. */
+bool page_add_file(struct file* file, off_t ofs, void* upage, uint32_t read_bytes,
+                   bool writable) {
+  ASSERT(read_bytes <= PGSIZE);
+
+  if (read_bytes == 0)
+    return page_add_zero(upage, writable);
+
+  struct page* page = page_create(upage, PAGE_FILE, writable);
+  if (page == NULL)
+    return false;
+  page->file = file;
+  page->ofs = ofs;
+  page->read_bytes = read_bytes;
+  return page_add(page);
+}
+
+/* Records that UPAGE in the current process starts out zeroed. */
+bool page_add_zero(void* upage, bool writable) {
+  struct page* page = page_create(upage, PAGE_ZERO, writable);
+  return page != NULL && page_add(page);
+}
+
+/* Records that UPAGE in the current process maps READ_BYTES bytes
+   of FILE starting at OFS, followed by zeros.  Changes to the page
+   are written back to FILE.  Returns false if UPAGE is already
+   recorded or memory is short. */
+bool page_add_mmap(struct file* file, off_t ofs, void* upage, uint32_t read_bytes) {
+  ASSERT(read_bytes > 0 && read_bytes <= PGSIZE);
+
+  struct page* page = page_create(upage, PAGE_MMAP, true);
+  if (page == NULL)
+    return false;
+  page->file = file;
+  page->ofs = ofs;
+  page->read_bytes = read_bytes;
+  return page_add(page);
+}
+
+/* Returns the page of P containing UADDR, or NULL if there is
+   none.  The caller must hold P's page_lock. */
+struct page* page_find(struct process* p, const void* uaddr) {
+  struct page key;
+  struct hash_elem* e;
+
+  key.upage = pg_round_down(uaddr);
+  e = hash_find(&p->pages, &key.elem);
+  return e != NULL ? hash_entry(e, struct page, elem) : NULL;
+}
+
+/* Returns the page of P containing UADDR.  If there is none but
+   UADDR looks like a stack access by the current thread, whose
+   user stack pointer is ESP, adds a zero page for it.  ESP may be null to
+   disable stack growth.  The caller must hold P's page_lock. */
+static struct page* page_find_or_grow(struct process* p, const void* uaddr, const void* esp) {
+  struct page* page = page_find(p, uaddr);
+  const uint8_t* addr = uaddr;
+
+  if (page != NULL || esp == NULL)
+    return page;
+  if (!is_user_vaddr(addr) || !user_stack_contains(addr) ||
+      addr + STACK_SLOP < (const uint8_t*)esp)
+    return NULL;
+
+  page = page_create(pg_round_down(uaddr), PAGE_ZERO, true);
+  if (page != NULL)
+    hash_insert(&p->pages, &page->elem);
+  return page;
+}
+
+/* Reads PAGE into a new frame and maps it into P, or maps the
+   shared frame that already holds it.  The frame is left pinned.
+   The caller must hold P's page_lock. */
+static bool page_load(struct process* p, struct page* page) {
+  bool swapped = page->swap_slot != SWAP_NONE;
+  bool share = page->type == PAGE_FILE && !swapped;
+  struct inode* inode = share ? file_get_inode(page->file) : NULL;
+  struct frame* frame;
+
+  if (share) {
+    frame = frame_share_find(page, inode, page->ofs, page->read_bytes);
+    if (frame != NULL) {
+      if (!pagedir_set_page(p->pagedir, page->upage, frame->kpage, false)) {
+        frame_release(frame, page);
+        frame_unpin(frame);
+        return false;
+      }
+      page->frame = frame;
+      page->cow = page->writable;
+      return true;
+    }
+  }
+
+  frame = frame_alloc(page);
+  if (frame == NULL)
+    return false;
+
+  uint8_t* kpage = frame->kpage;
+  if (swapped) {
+    swap_in(page->swap_slot, kpage);
+    page->swap_slot = SWAP_NONE;
+  } else if (page->type == PAGE_FILE || page->type == PAGE_MMAP) {
+    if (file_read_at(page->file, kpage, page->read_bytes, page->ofs) != (off_t)page->read_bytes) {
+      frame_release(frame, page);
+      frame_unpin(frame);
+      return false;
+    }
+    memset(kpage + page->read_bytes, 0, PGSIZE - page->read_bytes);
+  } else
+    memset(kpage, 0, PGSIZE);
+
+  if (!pagedir_set_page(p->pagedir, page->upage, kpage, page->writable && !share)) {
+    frame_release(frame, page);
+    frame_unpin(frame);
+    return false;
+  }
+  if (swapped)
+    pagedir_set_dirty(p->pagedir, page->upage, true);
+  if (share)
+    frame_share_add(frame, inode, page->ofs, page->read_bytes);
+  page->frame = frame;
+  page->cow = share && page->writable;
+  return true;
+}
+
+/* Gives PAGE of P, which is mapped read-only in a shared frame, a
+   private writable frame: the same frame if no other page holds
+   it, otherwise a copy.  The caller must hold P's page_lock. */
+static bool page_break_cow(struct process* p, struct page* page) {
+  struct frame* frame = page->frame;
+
+  ASSERT(page->cow);
+
+  if (!frame_make_private(frame, page)) {
+    struct frame* copy;
+
+    /* Keep the shared frame while copying out of it. */
+    frame_pin(frame);
+    frame_release(frame, page);
+    copy = frame_alloc(page);
+    if (copy == NULL) {
+      frame_attach(frame, page);
+      frame_unpin(frame);
+      return false;
+    }
+    memcpy(copy->kpage, frame->kpage, PGSIZE);
+    frame_unpin(frame);
+    frame = copy;
+  } else
+    frame_pin(frame);
+
+  pagedir_clear_page(p->pagedir, page->upage);
+  if (!pagedir_set_page(p->pagedir, page->upage, frame->kpage, true))
+    PANIC("remapping a present page failed");
+  page->frame = frame;
+  page->cow = false;
+  frame_unpin(frame);
+  return true;
+}
+
+/* Unmaps PAGE of P from its frame, writing it to swap if it was
+   modified.  Called by the frame table with P's page_lock held. */
+void page_evict(struct process* p, struct page* page) {
+  enum intr_level old_level;
+  bool dirty;
+
+  ASSERT(lock_held_by_current_thread(&p->page_lock));
+  ASSERT(page->frame != NULL);
+
+  /* Read the dirty bit and unmap in one step, so that a write by
+     another thread of P cannot slip in between. */
+  old_level = intr_disable();
+  dirty = pagedir_is_dirty(p->pagedir, page->upage);
+  pagedir_clear_page(p->pagedir, page->upage);
+  intr_set_level(old_level);
+
+  if (dirty && page->type == PAGE_MMAP)
+    file_write_at(page->file, page->frame->kpage, page->read_bytes, page->ofs);
+  else if (dirty) {
+    page->swap_slot = swap_out(page->frame->kpage);
+    if (page->swap_slot == SWAP_NONE)
+      PANIC("out of swap space");
+  }
+  page->frame = NULL;
+}
+
+/* Brings in the page containing FAULT_ADDR for the current
+   process, growing the stack if FAULT_ADDR is close enough to the
+   user stack pointer ESP.  Returns false if the address is not
+   part of the process, if WRITE is true and the page is
+   read-only, or if the page could not be read. */
+bool page_fault_in(const void* fault_addr, bool write, const void* esp) {
+  struct process* p = thread_current()->pcb;
+  struct page* page;
+  bool success;
+
+  if (p == NULL || p->pagedir == NULL || !is_user_vaddr(fault_addr))
+    return false;
+
+  lock_acquire(&p->page_lock);
+  page = page_find_or_grow(p, fault_addr, esp);
+  if (page == NULL || (write && !page->writable))
+    success = false;
+  else if (page->frame != NULL)
+    success = !write || !page->cow || page_break_cow(p, page);
+  else {
+    success = page_load(p, page);
+    if (success)
+      frame_unpin(page->frame);
+  }
+  lock_release(&p->page_lock);
+  return success;
+}
+
+/* Makes every page of the user buffer of SIZE bytes at BUFFER
+   present and pins it, so that the kernel can copy to or from it
+   without faulting while holding file system locks.  If WRITE is
+   true the pages must also be writable.  Returns false, with
+   nothing left pinned, if any part of the buffer is not valid
+   user memory.  Release the pages with page_unpin(). */
+bool page_pin(const void* buffer, size_t size, bool write) {
+  struct process* p = thread_current()->pcb;
+  const uint8_t* upage;
+  const uint8_t* end;
+  bool success = true;
+
+  if (size == 0)
+    return true;
+  end = (const uint8_t*)buffer + size - 1;
+  if (end < (const uint8_t*)buffer || !is_user_vaddr(end))
+    return false;
+
+  lock_acquire(&p->page_lock);
+  for (upage = pg_round_down(buffer); upage <= end; upage += PGSIZE) {
+    const void* addr = upage < (const uint8_t*)buffer ? buffer : (const void*)upage;
+    struct page* page = page_find_or_grow(p, addr, thread_current()->user_esp);
+    if (page == NULL || (write && !page->writable))
+      success = false;
+    else if (page->frame == NULL && page_load(p, page))
+      frame_unpin(page->frame);
+    else if (page->frame == NULL)
+      success = false;
+    if (success && write && page->cow)
+      success = page_break_cow(p, page);
+    if (!success)
+      break;
+    frame_pin(page->frame);
+  }
+  lock_release(&p->page_lock);
+
+  if (!success && upage > (const uint8_t*)pg_round_down(buffer))
+    page_unpin(buffer, upage - (const uint8_t*)buffer);
+  return success;
+}
+
+/* Unpins the pages of a buffer pinned by page_pin(). */
+void page_unpin(const void* buffer, size_t size) {
+  struct process* p = thread_current()->pcb;
+  const uint8_t* upage;
+  const uint8_t* end;
+
+  if (size == 0)
+    return;
+  end = (const uint8_t*)buffer + size - 1;
+
+  lock_acquire(&p->page_lock);
+  for (upage = pg_round_down(buffer); upage <= end; upage += PGSIZE) {
+    struct page* page = page_find(p, upage);
+    if (page != NULL && page->frame != NULL)
+      frame_unpin(page->frame);
+  }
+  lock_release(&p->page_lock);
+}
+
+/* Returns a hash value for page E. */
+static unsigned page_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct page* page = hash_entry(e, struct page, elem);
+  return hash_int((int)page->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool page_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct page, elem)->upage < hash_entry(b, struct page, elem)->upage;
+}
+
+/* Frees PAGE of P along with its frame or swap slot, writing it
+   back first if it is a dirty file mapping.  The caller must hold
+   P's page_lock and have removed PAGE from the table. */
+static void page_release(struct process* p, struct page* page) {
+  if (page->frame != NULL) {
+    if (page->type == PAGE_MMAP && pagedir_is_dirty(p->pagedir, page->upage))
+      file_write_at(page->file, page->frame->kpage, page->read_bytes, page->ofs);
+    pagedir_clear_page(p->pagedir, page->upage);
+    frame_release(page->frame, page);
+  }
+  if (page->swap_slot != SWAP_NONE)
+    swap_free(page->swap_slot);
+  free(page);
+}
+
+/* Removes the page at UPAGE from the current process, if there is
+   one. */
+void page_remove(void* upage) {
+  struct process* p = thread_current()->pcb;
+  struct page* page;
+
+  lock_acquire(&p->page_lock);
+  page = page_find(p, upage);
+  if (page != NULL) {
+    hash_delete(&p->pages, &page->elem);
+    page_release(p, page);
+  }
+  lock_release(&p->page_lock);
+}
+
+/* Frees page E of process P_. */
+static void page_free(struct hash_elem* e, void* p_) {
+  page_release(p_, hash_entry(e, struct page, elem));
+}
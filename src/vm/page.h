@@ -0,0 +1,55 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct frame;
+struct process;
+
+/* Where the contents of a page come from when it is faulted in. */
+enum page_type {
+  PAGE_FILE, /* Read from a file, zero-filling the rest. */
+  PAGE_ZERO, /* All zeros. */
+  PAGE_MMAP  /* Mapped file; written back to the file, not swap. */
+};
+
+/* A page of a process's address space, recorded in its
+   supplemental page table. A page is present when it has a frame;
+   otherwise it is brought in on the first fault at its address,
+   from swap if it was evicted dirty and from its backing store
+   if not. */
+struct page {
+  void* upage;                 /* User virtual address of the page. */
+  enum page_type type;         /* Backing store. */
+  bool writable;               /* False for read-only pages. */
+  struct file* file;           /* File to read from, for PAGE_FILE and PAGE_MMAP. */
+  off_t ofs;                   /* Offset of the page's data in FILE. */
+  uint32_t read_bytes;         /* Bytes to read; the rest of the page is zeroed. */
+  struct process* owner;       /* Process the page belongs to. */
+  struct frame* frame;         /* Frame holding the page, or NULL. */
+  bool cow;                    /* Writable, but mapped read-only in a shared frame. */
+  size_t swap_slot;            /* Swap slot holding the page, or SWAP_NONE. */
+  struct list_elem frame_elem; /* Element in the frame's page list. */
+  bool evict_locked;           /* Owner's lock was taken by the evicting thread. */
+  struct hash_elem elem;       /* Element in the process's page table. */
+};
+
+void page_table_init(struct process*);
+void page_table_destroy(struct process*);
+
+bool page_add_file(struct file*, off_t ofs, void* upage, uint32_t read_bytes, bool writable);
+bool page_add_zero(void* upage, bool writable);
+bool page_add_mmap(struct file*, off_t ofs, void* upage, uint32_t read_bytes);
+void page_remove(void* upage);
+struct page* page_find(struct process*, const void* uaddr);
+
+bool page_fault_in(const void* fault_addr, bool write, const void* esp);
+void page_evict(struct process*, struct page*);
+bool page_pin(const void* buffer, size_t size, bool write);
+void page_unpin(const void* buffer, size_t size);
+
+#endif /* vm/page.h */
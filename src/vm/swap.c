@@ -0,0 +1,77 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap space.
+
+   The swap device is divided into page-sized slots.  A bitmap
+   records which slots hold a page; a page is written to the
+   first free slot when it is evicted and its slot is released as
+   soon as it is read back in. */
+
+/* Sectors per swap slot. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block* swap_device; /* Swap device, or NULL if none. */
+static struct bitmap* used_slots; /* Slots holding a page. */
+static struct lock swap_lock;     /* Guards USED_SLOTS. */
+
+/* Initializes swap space on the BLOCK_SWAP device.  Without one,
+   pages that must be saved cannot be evicted. */
+void swap_init(void) {
+  size_t slot_cnt = 0;
+
+  lock_init(&swap_lock);
+  swap_device = block_get_role(BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size(swap_device) / PAGE_SECTORS;
+  else
+    printf("swap: no swap device, dirty pages will not be evicted\n");
+
+  used_slots = bitmap_create(slot_cnt);
+  if (used_slots == NULL)
+    PANIC("swap bitmap creation failed");
+}
+
+/* Returns true if every swap slot is in use. */
+bool swap_full(void) {
+  bool full;
+
+  lock_acquire(&swap_lock);
+  full = bitmap_all(used_slots, 0, bitmap_size(used_slots));
+  lock_release(&swap_lock);
+  return full;
+}
+
+/* Writes the page at KPAGE to a free slot and returns the slot,
+   or SWAP_NONE if swap is full. */
+size_t swap_out(const void* kpage) {
+  size_t slot;
+
+  lock_acquire(&swap_lock);
+  slot = bitmap_scan_and_flip(used_slots, 0, 1, false);
+  lock_release(&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_NONE;
+
+  block_write_multiple(swap_device, slot * PAGE_SECTORS, PAGE_SECTORS, kpage);
+  return slot;
+}
+
+/* Reads the page in SLOT into KPAGE and releases the slot. */
+void swap_in(size_t slot, void* kpage) {
+  block_read_multiple(swap_device, slot * PAGE_SECTORS, PAGE_SECTORS, kpage);
+  swap_free(slot);
+}
+
+/* Releases SLOT without reading it. */
+void swap_free(size_t slot) {
+  lock_acquire(&swap_lock);
+  ASSERT(bitmap_test(used_slots, slot));
+  bitmap_reset(used_slots, slot);
+  lock_release(&swap_lock);
+}
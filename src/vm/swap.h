@@ -0,0 +1,17 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Slot number meaning "not in swap". */
+#define SWAP_NONE SIZE_MAX
+
+void swap_init(void);
+bool swap_full(void);
+size_t swap_out(const void* kpage);
+void swap_in(size_t slot, void* kpage);
+void swap_free(size_t slot);
+
+#endif /* vm/swap.h */